@@ -5,6 +5,9 @@
 
 #include "malloc_hook.h"
 #include "luashrtbl.h"
+#include "skynet_pool.h"
+#include "skynet_slab.h"
+#include "skynet_timer.h"
 
 /***************************
 函数功能：获得所有服务分配的内存大小
@@ -78,6 +81,44 @@ lcurrent(lua_State *L) {
 	return 1;
 }
 
+static void
+push_poolstat(lua_State *L, struct skynet_pool_stat *st) {
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, (lua_Integer)st->size);
+	lua_setfield(L, -2, "size");
+	lua_pushinteger(L, (lua_Integer)st->total);
+	lua_setfield(L, -2, "total");
+	lua_pushinteger(L, (lua_Integer)st->used);
+	lua_setfield(L, -2, "used");
+	lua_pushinteger(L, (lua_Integer)st->cached);
+	lua_setfield(L, -2, "cached");
+	lua_pushinteger(L, (lua_Integer)st->depot);
+	lua_setfield(L, -2, "depot");
+}
+
+//获得定时器节点对象池的统计信息
+static int
+ltimerpool(lua_State *L) {
+	struct skynet_pool_stat st;
+	skynet_timer_poolstat(&st);
+	push_poolstat(L, &st);
+	return 1;
+}
+
+//获得消息内容slab每种大小的统计信息，没有开启时返回空表
+static int
+lslab(lua_State *L) {
+	struct skynet_pool_stat st[16];
+	int n = skynet_slab_stat(st, sizeof(st)/sizeof(st[0]));
+	lua_createtable(L, n, 0);
+	int i;
+	for (i=0;i<n;i++) {
+		push_poolstat(L, &st[i]);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_skynet_memory(lua_State *L) {
 	luaL_checkversion(L);
@@ -91,6 +132,8 @@ luaopen_skynet_memory(lua_State *L) {
 		{ "ssinfo", luaS_shrinfo },
 		{ "ssexpand", lexpandshrtbl },
 		{ "current", lcurrent },
+		{ "timerpool", ltimerpool },
+		{ "slab", lslab },
 		{ NULL, NULL },
 	};
 
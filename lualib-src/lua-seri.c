@@ -4,7 +4,9 @@
 
 #define LUA_LIB
 
-#include "skynet_malloc.h"
+#include "skynet.h"
+#include "skynet_slab.h"
+#include "lua-seri.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -712,10 +714,7 @@ unpack_one(lua_State *L, struct read_block *rb) {
 返回值：无
 ***************************/
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);	//分配写缓存队列写入的字节大小的内存
-	uint8_t * ptr = buffer;
-	int sz = len;
+seri_copy(uint8_t * ptr, struct block *b, int len) {
 	while(len>0) {			//将写缓存队列中的内容拷贝到分配的缓存中
 		if (len >= BLOCK_SIZE) {
 			memcpy(ptr, b->buffer, BLOCK_SIZE);
@@ -727,6 +726,13 @@ seri(lua_State *L, struct block *b, int len) {
 			break;
 		}
 	}
+}
+
+static void
+seri(lua_State *L, struct block *b, int len) {
+	uint8_t * buffer = skynet_slab_alloc(len);	//分配写缓存队列写入的字节大小的内存，小的消息来自slab
+	int sz = len;
+	seri_copy(buffer, b, len);
 	
 	lua_pushlightuserdata(L, buffer);	//将缓存的指针入栈
 	lua_pushinteger(L, sz);				//将缓存的大小入栈
@@ -750,7 +756,11 @@ luaseri_unpack(lua_State *L) {
 		size_t sz;
 		 buffer = (void *)lua_tolstring(L,1,&sz);	//将第一个元素转换为一个 C 字符串存入缓存，并将字符串长度存入sz
 		len = (int)sz;
-	} else {
+	} else if (lua_type(L,1) == LUA_TUSERDATA && luaL_testudata(L, 1, LUASERI_SHARED)) {	//luaseri_packshared打包的共享消息，直接读取不拷贝
+		struct luaseri_shared * s = lua_touserdata(L, 1);
+		buffer = s->msg;
+		len = (int)s->sz;
+	} else {	//其他的userdata和lightuserdata一样需要传入大小
 		buffer = lua_touserdata(L,1);	//将第一个元素转换为指针赋值给buffer
 		len = luaL_checkinteger(L,2);	//指针所指内容的大小
 	}
@@ -806,3 +816,44 @@ luaseri_pack(lua_State *L) {
 
 	return 2;
 }
+
+static int
+lshared_gc(lua_State *L) {
+	struct luaseri_shared * s = lua_touserdata(L, 1);
+	if (s->msg) {
+		skynet_shared_release(s->msg);
+		s->msg = NULL;
+	}
+	return 0;
+}
+
+/***************************
+函数功能：将栈中的内容序列化到一块引用计数的共享内存中，可以发送给多个服务而不需要再拷贝
+lua调用时需要传入的参数：需要序列化的内容
+返回值：返回值的数量：1
+	1）共享消息的userdata，被回收时释放它持有的引用
+***************************/
+LUAMOD_API int
+luaseri_packshared(lua_State *L) {
+	struct block temp;
+	temp.next = NULL;
+	struct write_block wb;
+	wb_init(&wb, &temp);
+	pack_from(L,&wb,0);
+	assert(wb.head == &temp);
+
+	struct luaseri_shared * s = lua_newuserdata(L, sizeof(*s));
+	s->msg = NULL;
+	s->sz = wb.len;
+	if (luaL_newmetatable(L, LUASERI_SHARED)) {
+		lua_pushcfunction(L, lshared_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	s->msg = skynet_shared_new(NULL, wb.len);
+	seri_copy(s->msg, &temp, wb.len);
+
+	wb_free(&wb);
+
+	return 1;
+}
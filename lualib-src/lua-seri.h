@@ -3,7 +3,16 @@
 
 #include <lua.h>
 
+// A serialized message in a shared payload (see skynet_shared_new), the userdata holds one reference.
+#define LUASERI_SHARED "SKYNET_SHARED"
+
+struct luaseri_shared {
+	void * msg;
+	size_t sz;
+};
+
 int luaseri_pack(lua_State *L);
+int luaseri_packshared(lua_State *L);
 int luaseri_unpack(lua_State *L);
 
 #endif
@@ -9,7 +9,9 @@
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
 struct snlua {
@@ -118,6 +120,7 @@ lcallback(lua_State *L) {
 	} else {
 		skynet_callback(context, gL, _cb);		//注册服务中的回调函数和回调对象
 	}
+	skynet_callback_inline(context, !forward);	//转发模式会保留消息内容
 
 	return 0;
 }
@@ -162,10 +165,24 @@ lintcommand(lua_State *L) {
 	const char * parm = NULL;
 	char tmp[64];	// for integer parm
 	if (lua_gettop(L) == 2) {		//判断函数的参数是否为两个
-		if (lua_isnumber(L, 2)) {	//如果第二个参数为数字
-			int32_t n = (int32_t)luaL_checkinteger(L,2);	//将函数第二个参数转换为整数形式
+		int isint = 0;
+		lua_Integer i = lua_tointegerx(L, 2, &isint);
+		if (isint) {	//如果第二个参数为整数
+			int32_t n = (int32_t)i;	//将函数第二个参数转换为整数形式
 			sprintf(tmp, "%d", n);
 			parm = tmp;		//第二个参数的字符串形式
+		} else if (lua_type(L, 2) == LUA_TNUMBER) {	// real number, such as TIMEOUT 0.5
+			lua_Number n = lua_tonumber(L, 2);
+			if (!isfinite(n)) {
+				return luaL_error(L, "Invalid number parm %f", n);
+			}
+			if (n > INT32_MAX) {	//和整数参数一样限制在int32的范围内
+				n = INT32_MAX;
+			} else if (n < INT32_MIN) {
+				n = INT32_MIN;
+			}
+			snprintf(tmp, sizeof(tmp), "%.3f", n);
+			parm = tmp;
 		} else {
 			parm = luaL_checkstring(L,2);	//获得第二个参数的字符串形式
 		}
@@ -222,7 +239,7 @@ get_dest_string(lua_State *L, int index) {
 	  idx_type：消息类型参数的在栈中的位置
 lua调用时需要传入的参数：
 	1）消息的目的服务handle或服务名，2）消息类型，3）消息中的session参数，为nil则系统分配，
-	4）消息的内容，5）如果消息内容为LUA_TLIGHTUSERDATA类型则需要该参数，该参数为消息内容的长度
+	4）消息的内容，可以为skynet.packshared打包的共享消息，5）如果消息内容为LUA_TLIGHTUSERDATA类型则需要该参数，该参数为消息内容的长度
 返回值：返回值的数量：1
 	1）将session入栈
 ***************************/
@@ -276,6 +293,15 @@ send_message(lua_State *L, int source, int idx_type) {
 		}
 		break;
 	}
+	case LUA_TUSERDATA: {		//skynet.packshared打包的共享消息，只增加引用计数
+		struct luaseri_shared * s = luaL_checkudata(L, idx_type+2, LUASERI_SHARED);
+		if (dest_string) {
+			session = skynet_sendname(context, source, dest_string, type | PTYPE_TAG_SHARED, session, s->msg, s->sz);
+		} else {
+			session = skynet_send(context, source, dest, type | PTYPE_TAG_SHARED, session, s->msg, s->sz);
+		}
+		break;
+	}
 	default:
 		luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L,idx_type+2)));
 	}
@@ -310,6 +336,59 @@ lsend(lua_State *L) {
 	return send_message(L, 0, 2);
 }
 
+/***************************
+函数功能：向多个服务发送同一条不需要回应的消息，消息内容只拷贝一次并由接收者共享
+lua调用时需要传入的参数：
+	1）目的服务handle的数组，2）消息类型，3）消息的内容，可以为skynet.packshared打包的共享消息，4）如果消息内容为LUA_TLIGHTUSERDATA类型则需要该参数，该参数为消息内容的长度
+返回值：返回值的数量：1
+	1）成功发送的数量
+***************************/
+static int
+lsendmulti(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int type = luaL_checkinteger(L, 2);
+	void * msg = NULL;
+	size_t len = 0;
+	switch (lua_type(L, 3)) {
+	case LUA_TSTRING:
+		msg = (void *)lua_tolstring(L, 3, &len);
+		break;
+	case LUA_TLIGHTUSERDATA:
+		msg = lua_touserdata(L, 3);
+		len = luaL_checkinteger(L, 4);
+		type |= PTYPE_TAG_DONTCOPY;
+		break;
+	case LUA_TUSERDATA: {
+		struct luaseri_shared * s = luaL_checkudata(L, 3, LUASERI_SHARED);
+		msg = s->msg;
+		len = s->sz;
+		type |= PTYPE_TAG_SHARED;
+		break;
+	}
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L, 3)));
+	}
+	int n = lua_rawlen(L, 1);
+	uint32_t tmp[64];
+	uint32_t * dest = tmp;
+	if (n > (int)(sizeof(tmp)/sizeof(tmp[0]))) {
+		dest = skynet_malloc(n * sizeof(uint32_t));
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		lua_rawgeti(L, 1, i+1);
+		dest[i] = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	int count = skynet_sendmulti(context, 0, dest, n, type, msg, len);
+	if (dest != tmp) {
+		skynet_free(dest);
+	}
+	lua_pushinteger(L, count);
+	return 1;
+}
+
 /*
 	uint32 address
 	 string address
@@ -474,12 +553,14 @@ luaopen_skynet_core(lua_State *L) {
 		{ "send" , lsend },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
+		{ "sendmulti", lsendmulti },
 		{ "command" , lcommand },
 		{ "intcommand", lintcommand },
 		{ "error", lerror },
 		{ "tostring", ltostring },
 		{ "harbor", lharbor },
 		{ "pack", luaseri_pack },		//序列化函数
+		{ "packshared", luaseri_packshared },	//序列化到共享的消息内容
 		{ "unpack", luaseri_unpack },	//反序列化函数
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
@@ -839,6 +839,22 @@ ludp_send(lua_State *L) {
 	return 1;
 }
 
+/***************************
+函数功能：设置UDP套接字是否批量接收数据，开启后一个套接字消息中包含多个数据包
+	
+lua调用时需要传入的参数：
+	1）存储套接字信息的id，2）是否开启，默认为true
+返回值：返回值的数量：0
+***************************/
+static int
+ludp_batch(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	int enable = lua_isnoneornil(L, 2) ? 1 : lua_toboolean(L, 2);
+	skynet_socket_udp_batch(ctx, id, enable);
+	return 0;
+}
+
 /***************************
 函数功能：从指定的数据中获得ip地址和端口号
 	
@@ -906,6 +922,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "udp_connect", ludp_connect },
 		{ "udp_send", ludp_send },
 		{ "udp_address", ludp_address },
+		{ "udp_batch", ludp_batch },
 		{ NULL, NULL },
 	};
 	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context"); //将服务信息指针入栈
@@ -30,6 +30,7 @@ local skynet = {		--协议类型，即上面的协议id，即消息类型
 	PTYPE_DEBUG = 9,
 	PTYPE_LUA = 10,
 	PTYPE_SNAX = 11,
+	PTYPE_TIMER = 12,	-- coalesced timeouts, see skynet.coalescetimer
 }
 
 -- code cache
@@ -53,6 +54,7 @@ local unresponse = {}
 
 local wakeup_queue = {}
 local sleep_session = {}			--以协程句柄为键，等待该消息session响应的协程，即记录处于睡眠的协程
+local timeout_session = {}			--skynet.timeout返回的还没有触发的session对应的func，只有它们可以被skynet.canceltimeout取消
 
 local watching_service = {}
 local watching_session = {}
@@ -127,7 +129,11 @@ local function dispatch_wakeup()
 	if co then
 		local session = sleep_session[co]
 		if session then
-			session_id_coroutine[session] = "BREAK"
+			if c.intcommand("CANCEL", session) then
+				session_id_coroutine[session] = nil 	--定时已取消，不会再收到回应
+			else
+				session_id_coroutine[session] = "BREAK"
+			end
 			return suspend(co, coroutine_resume(co, false, "BREAK"))
 		end
 	end
@@ -265,16 +271,49 @@ function suspend(co, result, command, param, size)
 	dispatch_error_queue()
 end
 
---定时ti(单位为1/100秒)执行函数func
+--定时ti(单位为1/100秒，可以带小数，精度取决于配置timer_tick)执行函数func
 function skynet.timeout(ti, func)
 	local session = c.intcommand("TIMEOUT",ti)
 	assert(session)
-	local co = co_create(func)		--创建协程
 	assert(session_id_coroutine[session] == nil)  --判断是否为新的session，用于接收消息响应时，定位到是响应哪一条消息，由发送消息的服务生成
-	session_id_coroutine[session] = co 		--记录下新协程的句柄
+	session_id_coroutine[session] = "TIMEOUT" 	--定时触发时才创建协程，被取消的定时不占用协程
+	timeout_session[session] = func
+	return session
+end
+
+--开启后，同一时刻到期的本服务的定时合并为一条消息投递，在一次回调中依次唤起对应的协程
+function skynet.coalescetimer(enable)
+	c.command("TIMERCOALESCE", enable and "1" or "0")
+end
+
+--向addresses数组中的服务发送同一条消息，消息内容只拷贝一次，由本节点的接收者共享，返回成功发送的数量
+function skynet.sendmulti(addresses, typename, ...)
+	local p = proto[typename]
+	return c.sendmulti(addresses, p.id, p.pack(...))
+end
+
+--向addresses数组中的服务发送未经过打包的消息，例如skynet.packshared的结果
+function skynet.rawsendmulti(addresses, typename, msg, sz)
+	local p = proto[typename]
+	return c.sendmulti(addresses, p.id, msg, sz)
+end
+
+--取消skynet.timeout返回的定时，func不会再被调用
+function skynet.canceltimeout(session)
+	if not timeout_session[session] then	--已经触发或者不是skynet.timeout的session，例如skynet.call的
+		return false
+	end
+	timeout_session[session] = nil
+	if c.intcommand("CANCEL", session) then
+		session_id_coroutine[session] = nil
+	else
+		-- the response is in the message queue already
+		session_id_coroutine[session] = "BREAK"
+	end
+	return true
 end
 
---睡眠ti(单位为1/100秒)等待协程被唤起
+--睡眠ti(单位为1/100秒，可以带小数，如0.1为1毫秒)等待协程被唤起
 function skynet.sleep(ti)
 	local session = c.intcommand("TIMEOUT",ti)		--发送计时
 	assert(session)
@@ -397,6 +436,8 @@ end
 skynet.pack = assert(c.pack)	--打包函数为lua-seri.c中的luaseri_pack函数
 skynet.packstring = assert(c.packstring)	--打包字符串的函数为lua-skynet.c中的lpackstring函数
 skynet.unpack = assert(c.unpack)	--解包函数为lua-seri.c中的luaseri_unpack函数
+--打包到引用计数的共享内存中，结果可以用skynet.rawsend、skynet.rawsendmulti发送给多个服务而不再拷贝，也可以直接skynet.unpack
+skynet.packshared = assert(c.packshared)
 skynet.tostring = assert(c.tostring) 	--转换为字符串函数，为lua-skynet.c中的ltostring函数
 skynet.trash = assert(c.trash)	--释放轻量用户数据，为lua-skynet.c中的ltrash函数
 
@@ -506,17 +547,30 @@ end
 	3）sz消息大小，4）session对应回应哪条消息，5）source消息源
 返回值：无返回值
 ]]
+local function dispatch_response(session, source, msg, sz)
+	local co = session_id_coroutine[session] 	--获得处理回应消息的协程
+	if co == "BREAK" then
+		session_id_coroutine[session] = nil
+	elseif co == nil then
+		unknown_response(session, source, msg, sz)
+	else
+		session_id_coroutine[session] = nil
+		if co == "TIMEOUT" then 	--skynet.timeout的定时触发，此时才创建协程
+			co = co_create(timeout_session[session])
+			timeout_session[session] = nil
+		end
+		suspend(co, coroutine_resume(co, true, msg, sz))
+	end
+end
+
 local function raw_dispatch_message(prototype, msg, sz, session, source)
 	-- skynet.PTYPE_RESPONSE = 1, read skynet.h
 	if prototype == 1 then --回应包消息类型 消息类型为 skynet.PTYPE_RESPONSE 的消息
-		local co = session_id_coroutine[session] 	--获得处理回应消息的协程
-		if co == "BREAK" then
-			session_id_coroutine[session] = nil
-		elseif co == nil then
-			unknown_response(session, source, msg, sz)
-		else
-			session_id_coroutine[session] = nil
-			suspend(co, coroutine_resume(co, true, msg, sz))
+		dispatch_response(session, source, msg, sz)
+	elseif prototype == 12 then 	-- skynet.PTYPE_TIMER, 同时触发的多个定时，消息内容为int类型的session数组
+		local sessions = c.tostring(msg, sz)
+		for i = 1, sz, 4 do
+			dispatch_response((string.unpack("=i4", sessions, i)), source, nil, 0)
 		end
 	else 	--不需要回应的消息
 		local p = proto[prototype]	--获得该消息类型的协议信息
@@ -717,10 +771,22 @@ end
 --what为"cpu"，获得该服务消耗CPU时间，整数部分为秒，小数部分精确到微秒
 --what为"time"，获得距离该服务最近一条消息处理开始的时间间隔
 --what为"message"，该服务已经处理消息的数量
+--what为"wait_p99"等，获得消息在服务队列中等待时长的百分位数（秒），"wait_max"为最大值
+--what为"exec_p99"等，获得服务处理消息消耗CPU时间的百分位数（秒），"exec_max"为最大值
 function skynet.stat(what)
 	return c.intcommand("STAT", what)
 end
 
+--设置服务的调度优先级，level为"high"或"normal"，为nil时只获取，返回当前的优先级
+--高优先级的服务队列会先于普通服务队列被工作线程处理
+function skynet.priority(level)
+	if level then
+		return c.command("PRIORITY", level)
+	else
+		return c.command("PRIORITY")
+	end
+end
+
 function skynet.task(ret)
 	local t = 0
 	for session,co in pairs(session_id_coroutine) do
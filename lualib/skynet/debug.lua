@@ -29,6 +29,13 @@ local function init(skynet, export)
 			stat.mqlen = skynet.stat "mqlen"
 			stat.cpu = skynet.stat "cpu"
 			stat.message = skynet.stat "message"
+			stat.wait_p50 = skynet.stat "wait_p50"
+			stat.wait_p99 = skynet.stat "wait_p99"
+			stat.exec_p99 = skynet.stat "exec_p99"
+			local schedule = skynet.stat "schedule"
+			if schedule > 0 then
+				stat.migrate = skynet.stat "migrate" / schedule
+			end
 			skynet.ret(skynet.pack(stat))
 		end
 
@@ -153,6 +153,28 @@ socket_message[7] = function(id, size)
 	end
 end
 
+-- SKYNET_SOCKET_TYPE_UDPBATCH = 8
+-- each datagram is a 2 bytes size, the address (7 bytes for ipv4, 19 bytes for ipv6) and the payload
+socket_message[8] = function(id, size, data)
+	local s = socket_pool[id]
+	if s == nil or s.callback == nil then
+		skynet.error("socket: drop udp package from " .. id)
+		driver.drop(data, size)
+		return
+	end
+	local str = skynet.tostring(data, size)
+	skynet_core.trash(data, size)
+	local index = 1
+	while index <= size do
+		local sz, protocol = string.unpack("=I2B", str, index)
+		local addrsz = protocol == 1 and 7 or 19
+		local address = str:sub(index + 2, index + 1 + addrsz)
+		index = index + 2 + addrsz
+		s.callback(str:sub(index, index + sz - 1), address)
+		index = index + sz
+	end
+end
+
 skynet.register_protocol {
 	name = "socket",
 	id = skynet.PTYPE_SOCKET,	-- PTYPE_SOCKET = 6
@@ -439,6 +461,11 @@ end
 socket.sendto = assert(driver.udp_send)
 socket.udp_address = assert(driver.udp_address)
 
+-- read many datagrams per syscall and deliver them in one message, the callback is still called once per datagram
+function socket.udp_batch(id, enable)
+	driver.udp_batch(id, enable ~= false)
+end
+
 function socket.warning(id, callback)
 	local obj = socket_pool[id]
 	assert(obj)
@@ -2,6 +2,7 @@
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
 #include "skynet_handle.h"
+#include "hashname.h"
 
 /*
 	harbor listen the PTYPE_HARBOR (in text)
@@ -21,7 +22,6 @@
 #include <stdint.h>
 #include <unistd.h>
 
-#define HASH_SIZE 4096
 #define DEFAULT_QUEUE_SIZE 1024
 
 // 12 is sizeof(struct remote_message_header)
@@ -51,15 +51,14 @@ struct harbor_msg_queue {
 };
 
 struct keyvalue {
-	struct keyvalue * next;
+	struct hashname_node node;
 	char key[GLOBALNAME_LENGTH];
-	uint32_t hash;
 	uint32_t value;
 	struct harbor_msg_queue * queue;
 };
 
 struct hashmap {
-	struct keyvalue *node[HASH_SIZE];
+	struct hashname index;
 };
 
 #define STATUS_WAIT 0
@@ -153,16 +152,8 @@ release_queue(struct harbor_msg_queue *queue) {
 
 static struct keyvalue *
 hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t*) name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue * node = hash->node[h % HASH_SIZE];
-	while (node) {
-		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
-			return node;
-		}
-		node = node->next;
-	}
-	return NULL;
+	uint32_t h = hashname_hash(name, GLOBALNAME_LENGTH);
+	return (struct keyvalue *)hashname_find(&hash->index, name, GLOBALNAME_LENGTH, h);
 }
 
 /*
@@ -171,34 +162,25 @@ hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 
 static struct void
 hash_erase(struct hashmap * hash, char name[GLOBALNAME_LENGTH) {
-	uint32_t *ptr = name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** ptr = &hash->node[h % HASH_SIZE];
-	while (*ptr) {
-		struct keyvalue * node = *ptr;
-		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
-			_release_queue(node->queue);
-			*ptr->next = node->next;
-			skynet_free(node);
-			return;
-		}
-		*ptr = &(node->next);
+	struct keyvalue * node = hash_search(hash, name);
+	if (node) {
+		hashname_remove(&hash->index, &node->node);
+		_release_queue(node->queue);
+		skynet_free(node);
 	}
 }
 */
 
 static struct keyvalue *
 hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t *)name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** pkv = &hash->node[h % HASH_SIZE];
 	struct keyvalue * node = skynet_malloc(sizeof(*node));
 	memcpy(node->key, name, GLOBALNAME_LENGTH);
-	node->next = *pkv;
+	node->node.name = node->key;
+	node->node.hash = hashname_hash(name, GLOBALNAME_LENGTH);
 	node->queue = NULL;
-	node->hash = h;
 	node->value = 0;
-	*pkv = node;
+	// harbor is the only reader, so free the old table at once.
+	skynet_free(hashname_insert(&hash->index, &node->node));
 
 	return node;
 }
@@ -206,22 +188,25 @@ hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 static struct hashmap * 
 hash_new() {
 	struct hashmap * h = skynet_malloc(sizeof(struct hashmap));
-	memset(h,0,sizeof(*h));
+	hashname_init(&h->index);
 	return h;
 }
 
 static void
 hash_delete(struct hashmap *hash) {
+	struct hashname_table * t = hash->index.table;
 	int i;
-	for (i=0;i<HASH_SIZE;i++) {
-		struct keyvalue * node = hash->node[i];
+	for (i=0;i<t->size;i++) {
+		struct hashname_node * node = t->slot[i];
 		while (node) {
-			struct keyvalue * next = node->next;
-			release_queue(node->queue);
-			skynet_free(node);
+			struct hashname_node * next = node->next;
+			struct keyvalue * kv = (struct keyvalue *)node;
+			release_queue(kv->queue);
+			skynet_free(kv);
 			node = next;
 		}
 	}
+	hashname_release(&hash->index);
 	skynet_free(hash);
 }
 
@@ -326,6 +326,11 @@ function COMMAND.cmem()
 	end
 	tmp.total = memory.total()
 	tmp.block = memory.block()
+	local tp = memory.timerpool()
+	tmp.timerpool = string.format("%d/%d nodes of %d bytes (cached %d, depot %d)", tp.used, tp.total, tp.size, tp.cached, tp.depot)
+	for _, s in ipairs(memory.slab()) do
+		tmp["slab" .. s.size] = string.format("%d/%d (cached %d, depot %d)", s.used, s.total, s.cached, s.depot)
+	end
 
 	return tmp
 end
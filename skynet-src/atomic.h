@@ -10,5 +10,6 @@
 #define ATOM_ADD(ptr,n) __sync_add_and_fetch(ptr, n)
 #define ATOM_SUB(ptr,n) __sync_sub_and_fetch(ptr, n)
 #define ATOM_AND(ptr,n) __sync_and_and_fetch(ptr, n)
+#define ATOM_SYNC() __sync_synchronize()
 
 #endif
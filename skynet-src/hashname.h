@@ -0,0 +1,140 @@
+#ifndef SKYNET_HASHNAME_H
+#define SKYNET_HASHNAME_H
+
+#include "skynet_malloc.h"
+#include "atomic.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// A chained hash table of names. The owner embeds struct hashname_node in its own node and sets node->name.
+// Writers (insert/remove) must be serialized by the caller, but hashname_find can run concurrently without a lock :
+// a hit is always valid, and a miss is retried if the table has been resized meanwhile.
+// A removed node or an old table may still be read by concurrent readers, so the caller decides when to free them.
+
+#define HASHNAME_DEFAULT_SIZE 16
+
+struct hashname_node {
+	struct hashname_node *next;		//同一个桶中的下一个节点
+	const char *name;				//名字，由拥有者存储
+	uint32_t hash;					//名字的哈希值
+};
+
+struct hashname_table {
+	int size;							//桶的数量，2的幂
+	struct hashname_node *slot[];		//桶
+};
+
+struct hashname {
+	unsigned int version;			//扩容时为奇数
+	int count;						//节点数量
+	struct hashname_table *table;	//当前的桶数组，扩容时整体替换
+};
+
+static inline struct hashname_table *
+hashname_table_new(int size) {
+	struct hashname_table *t = skynet_malloc(sizeof(*t) + size * sizeof(struct hashname_node *));
+	t->size = size;
+	memset(t->slot, 0, size * sizeof(struct hashname_node *));
+	return t;
+}
+
+static inline void
+hashname_init(struct hashname *h) {
+	h->version = 0;
+	h->count = 0;
+	h->table = hashname_table_new(HASHNAME_DEFAULT_SIZE);
+}
+
+// Only free the table, the nodes belong to the owner.
+static inline void
+hashname_release(struct hashname *h) {
+	skynet_free(h->table);
+	h->table = NULL;
+}
+
+//名字的哈希值(FNV-1a)，最多计算sz个字符
+static inline uint32_t
+hashname_hash(const char *name, size_t sz) {
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i=0;i<sz && name[i];i++) {
+		h ^= (uint8_t)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+//查找名字，最多比较sz个字符，没找到返回NULL
+static inline struct hashname_node *
+hashname_find(struct hashname *h, const char *name, size_t sz, uint32_t hash) {
+	for (;;) {
+		unsigned int version = h->version;
+		ATOM_SYNC();
+		struct hashname_table *t = h->table;
+		struct hashname_node *node = t->slot[hash & (t->size-1)];
+		while (node) {
+			if (node->hash == hash && strncmp(node->name, name, sz) == 0) {
+				return node;
+			}
+			node = node->next;
+		}
+		ATOM_SYNC();
+		if ((version & 1) == 0 && version == h->version) {	//扩容时节点可能被移到了其他桶，需要重新查找
+			return NULL;
+		}
+	}
+}
+
+//插入节点，调用前需设置好node->name和node->hash，且名字不在表中。
+//如果扩容，返回旧的桶数组，由调用者在没有读者之后释放，否则返回NULL
+static inline struct hashname_table *
+hashname_insert(struct hashname *h, struct hashname_node *node) {
+	struct hashname_table *old = NULL;
+	struct hashname_table *t = h->table;
+	if (h->count >= t->size) {
+		struct hashname_table *nt = hashname_table_new(t->size * 2);
+		ATOM_INC(&h->version);
+		int i;
+		for (i=0;i<t->size;i++) {
+			struct hashname_node *n = t->slot[i];
+			while (n) {
+				struct hashname_node *next = n->next;
+				struct hashname_node **p = &nt->slot[n->hash & (nt->size-1)];
+				n->next = *p;
+				*p = n;
+				n = next;
+			}
+			t->slot[i] = NULL;
+		}
+		ATOM_SYNC();
+		h->table = nt;
+		ATOM_INC(&h->version);
+		old = t;
+		t = nt;
+	}
+	struct hashname_node **p = &t->slot[node->hash & (t->size-1)];
+	node->next = *p;
+	ATOM_SYNC();
+	*p = node;
+	++h->count;
+	return old;
+}
+
+//从表中移除节点，节点的next不变，正在读的线程仍可以继续遍历
+static inline void
+hashname_remove(struct hashname *h, struct hashname_node *node) {
+	struct hashname_table *t = h->table;
+	struct hashname_node **p = &t->slot[node->hash & (t->size-1)];
+	while (*p) {
+		if (*p == node) {
+			*p = node->next;
+			--h->count;
+			return;
+		}
+		p = &(*p)->next;
+	}
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef SKYNET_HISTOGRAM_H
+#define SKYNET_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+// A log-linear (HDR style) histogram of microsecond values.
+// Each power of 2 is split into 4 buckets, so the relative error is below 25%.
+// It isn't thread safe, only the worker who dispatches the service records into it.
+
+#define HISTOGRAM_SUB 4
+#define HISTOGRAM_BUCKETS (32 * HISTOGRAM_SUB)
+
+struct histogram {
+	uint64_t count;							//记录的数量
+	uint32_t max;							//记录的最大值
+	uint32_t bucket[HISTOGRAM_BUCKETS];		//每个区间内的数量
+};
+
+static inline void
+histogram_init(struct histogram *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+//获得v所在的区间
+static inline int
+histogram_index(uint32_t v) {
+	if (v < HISTOGRAM_SUB) {
+		return (int)v;
+	}
+	int e = 31 - __builtin_clz(v);		// v in [2^e, 2^(e+1))
+	int m = (v >> (e - 2)) & (HISTOGRAM_SUB - 1);
+	return (e - 1) * HISTOGRAM_SUB + m;
+}
+
+//获得区间idx的下限
+static inline uint32_t
+histogram_lower(int idx) {
+	if (idx < HISTOGRAM_SUB) {
+		return (uint32_t)idx;
+	}
+	int e = idx / HISTOGRAM_SUB + 1;
+	int m = idx % HISTOGRAM_SUB;
+	return (uint32_t)(HISTOGRAM_SUB + m) << (e - 2);
+}
+
+static inline void
+histogram_record(struct histogram *h, uint32_t v) {
+	++h->bucket[histogram_index(v)];
+	++h->count;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+//获得百分位数percent（0-100）的近似值，返回所在区间的下限
+static inline uint32_t
+histogram_percentile(struct histogram *h, double percent) {
+	if (h->count == 0) {
+		return 0;
+	}
+	if (percent >= 100) {
+		return h->max;
+	}
+	uint64_t rank = (uint64_t)(h->count * percent / 100);
+	uint64_t n = 0;
+	int i;
+	for (i=0;i<HISTOGRAM_BUCKETS;i++) {
+		n += h->bucket[i];
+		if (n > rank) {
+			return histogram_lower(i);
+		}
+	}
+	return h->max;
+}
+
+#endif
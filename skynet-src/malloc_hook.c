@@ -7,7 +7,9 @@
 
 #include "malloc_hook.h"
 #include "skynet.h"
+#include "skynet_slab.h"
 #include "atomic.h"
+#include "spinlock.h"
 
 // turn on MEMORY_CHECK can do more memory check, such as double free
 // #define MEMORY_CHECK
@@ -151,6 +153,39 @@ mallctl_int64(const char* name, size_t* newval) {
 	return v;
 }
 
+#define MAX_NUMA_NODE 64
+
+static struct {
+	struct spinlock lock;
+	unsigned arena[MAX_NUMA_NODE];	//每个NUMA节点对应的arena序号+1，0表示尚未创建
+} _node_arena;
+
+//将当前线程绑定到NUMA节点node专用的arena，使该线程分配的内存尽量在本节点上，返回arena序号，失败返回-1
+int
+malloc_thread_arena(int node) {
+	if (node < 0 || node >= MAX_NUMA_NODE) {
+		return -1;
+	}
+	unsigned arena;
+	size_t sz = sizeof(arena);
+	spinlock_lock(&_node_arena.lock);
+	if (_node_arena.arena[node] == 0) {
+		if (je_mallctl("arenas.create", &arena, &sz, NULL, 0)) {
+			spinlock_unlock(&_node_arena.lock);
+			skynet_error(NULL, "Create arena for numa node %d failed", node);
+			return -1;
+		}
+		_node_arena.arena[node] = arena + 1;
+	}
+	arena = _node_arena.arena[node] - 1;
+	spinlock_unlock(&_node_arena.lock);
+	if (je_mallctl("thread.arena", NULL, NULL, &arena, sizeof(arena))) {
+		skynet_error(NULL, "Bind thread to arena %u failed", arena);
+		return -1;
+	}
+	return (int)arena;
+}
+
 int 
 mallctl_opt(const char* name, int* newval) {
 	int v = 0;
@@ -182,6 +217,13 @@ skynet_malloc(size_t size) {
 void *
 skynet_realloc(void *ptr, size_t size) {
 	if (ptr == NULL) return skynet_malloc(size);
+	size_t osize = skynet_slab_size(ptr);
+	if (osize) {	//slab中的对象大小固定，换成普通的内存
+		void *newptr = skynet_malloc(size);
+		memcpy(newptr, ptr, osize < size ? osize : size);
+		skynet_slab_free(ptr);
+		return newptr;
+	}
 
 	void* rawptr = clean_prefix(ptr);
 	void *newptr = je_realloc(rawptr, size+PREFIX_SIZE);
@@ -193,6 +235,7 @@ skynet_realloc(void *ptr, size_t size) {
 void
 skynet_free(void *ptr) {
 	if (ptr == NULL) return;
+	if (skynet_slab_free(ptr)) return;	//消息内容可能由skynet_slab_alloc分配
 	void* rawptr = clean_prefix(ptr);
 	je_free(rawptr);
 }
@@ -234,6 +277,12 @@ mallctl_opt(const char* name, int* newval) {
 	return 0;
 }
 
+int
+malloc_thread_arena(int node) {
+	skynet_error(NULL, "No jemalloc : numa arena for node %d.", node);
+	return -1;
+}
+
 #endif
 
 //获得所有服务分配的内存大小
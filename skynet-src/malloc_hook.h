@@ -9,6 +9,7 @@ extern size_t malloc_memory_block(void);
 extern void   memory_info_dump(void);
 extern size_t mallctl_int64(const char* name, size_t* newval);
 extern int    mallctl_opt(const char* name, int* newval);
+extern int    malloc_thread_arena(int node);
 extern void   dump_c_mem(void);
 extern int    dump_mem_lua(lua_State *L);
 extern size_t malloc_current_memory(void);
@@ -20,9 +20,11 @@
 #define PTYPE_RESERVED_DEBUG 9
 #define PTYPE_RESERVED_LUA 10
 #define PTYPE_RESERVED_SNAX 11
+#define PTYPE_TIMER 12						//合并投递的定时消息，消息内容为int类型的session数组
 
 #define PTYPE_TAG_DONTCOPY 0x10000			//该类型消息在发送时不需要进行拷贝，一般为服务发送给自己的消息
 #define PTYPE_TAG_ALLOCSESSION 0x20000		//标记消息的session需要系统分配
+#define PTYPE_TAG_SHARED 0x40000			//消息内容由skynet_shared_new创建，发送时不拷贝，消息持有一个新的引用
 
 struct skynet_context;
 
@@ -31,11 +33,21 @@ const char * skynet_command(struct skynet_context * context, const char * cmd ,
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
+int skynet_sendmulti(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * msg, size_t sz);
+
+// reference counted payload shared by many messages, the last receiver frees it.
+// Only a callback set as inline (see skynet_callback_inline) sees the shared payload itself,
+// the others get a private copy which they may reserve and free by skynet_free as usual.
+void * skynet_shared_new(const void * msg, size_t sz);
+void skynet_shared_retain(void * msg);
+void skynet_shared_release(void * msg);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
+// The callback never keeps msg after it returns, so a tiny or shared message can be passed in place without a heap copy.
+void skynet_callback_inline(struct skynet_context * context, int enable);
 
 uint32_t skynet_current_handle(void);
 uint64_t skynet_now(void);
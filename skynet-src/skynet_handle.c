@@ -3,34 +3,102 @@
 #include "skynet_handle.h"
 #include "skynet_server.h"
 #include "rwlock.h"
+#include "atomic.h"
+#include "hashname.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
 
 #define DEFAULT_SLOT_SIZE 4
-#define MAX_SLOT_SIZE 0x40000000
 
 struct handle_name {
-	char * name;		//服务名字
-	uint32_t handle;	//用于定位服务，高8位为节点编号，低24位为服务号
+	struct hashname_node node;			//名字索引的节点，node.name指向name
+	uint32_t handle;					//用于定位服务，高8位为节点编号，低24位为服务号
+	struct handle_name *retire_next;	//服务退出时，等待释放的服务名
+	char name[];						//服务名字
+};
+
+// skynet_handle_grab doesn't take any lock. Each reader thread publishes the epoch it entered in its own record,
+// and writers wait for the readers who may still see the old slot before releasing it (see handle_synchronize).
+struct handle_reader {
+	unsigned int epoch;				//进入时的epoch，0表示不在读
+	struct handle_reader *next;		//所有读线程的记录组成的链表
+	char padding[64 - sizeof(unsigned int) - sizeof(void *)];	//避免不同线程的记录处于同一缓存行
+};
+
+struct handle_slot {
+	int size;						//存储服务信息数组的大小
+	struct skynet_context * ctx[];	//存储服务信息数组
 };
 
 struct handle_storage {
-	struct rwlock lock;				//读写锁
+	struct rwlock lock;				//只用写锁，串行化对服务信息数组和服务名的修改，读不加锁
 
 	uint32_t harbor;				//定位节点
 	uint32_t handle_index;			//服务的信息下一个存储到slot的第几个
-	int slot_size;					//存储服务信息数组的大小
-	struct skynet_context ** slot;	//存储服务信息数组
-	
-	int name_cap;					//服务名数组的容量
-	int name_count;					//服务名数组当前存的服务名的数量
-	struct handle_name *name;		//服务名及定位服务的handle
+	struct handle_slot * slot;		//存储服务信息数组，扩容时整体替换
+	unsigned int epoch;				//每次等待读线程时递增
+	struct handle_reader *reader;	//所有读线程的记录
+	pthread_key_t reader_key;		//与线程关联的读记录
+
+	struct hashname name;			//服务名的哈希索引
 };
 
 static struct handle_storage *H = NULL;
 
+static struct handle_slot *
+slot_new(int size) {
+	struct handle_slot *slot = skynet_malloc(sizeof(*slot) + size * sizeof(struct skynet_context *));
+	slot->size = size;
+	memset(slot->ctx, 0, size * sizeof(struct skynet_context *));
+	return slot;
+}
+
+//进入读，此后读到的服务信息和服务信息数组在离开前不会被释放
+static struct handle_reader *
+reader_enter(struct handle_storage *s) {
+	struct handle_reader *r = pthread_getspecific(s->reader_key);
+	if (r == NULL) {	//线程第一次读时创建记录，记录不会释放
+		r = skynet_malloc(sizeof(*r));
+		r->epoch = 0;
+		do {
+			r->next = s->reader;
+		} while (!ATOM_CAS_POINTER(&s->reader, r->next, r));
+		pthread_setspecific(s->reader_key, r);
+	}
+	r->epoch = s->epoch;
+	ATOM_SYNC();
+	return r;
+}
+
+static inline void
+reader_leave(struct handle_reader *r) {
+	ATOM_SYNC();
+	r->epoch = 0;
+}
+
+//等待所有可能读到旧数据的读线程离开，调用前需要先把旧数据从服务信息数组中移除
+static void
+handle_synchronize(struct handle_storage *s) {
+	unsigned int epoch = s->epoch;
+	if (ATOM_INC(&s->epoch) == 0) {	// 0 means not reading
+		ATOM_INC(&s->epoch);
+	}
+	struct handle_reader *r;
+	for (r = s->reader; r; r = r->next) {
+		for (;;) {
+			unsigned int e = r->epoch;
+			if (e == 0 || (int)(e - epoch) > 0) {	//不在读或在移除之后才进入
+				break;
+			}
+			ATOM_SYNC();
+		}
+	}
+}
+
 //存储的服务的信息，并返回一个带节点编号的服务号
 uint32_t
 skynet_handle_register(struct skynet_context *ctx) {
@@ -40,11 +108,12 @@ skynet_handle_register(struct skynet_context *ctx) {
 	
 	for (;;) {
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		struct handle_slot *slot = s->slot;
+		for (i=0;i<slot->size;i++) {
 			uint32_t handle = (i+s->handle_index) & HANDLE_MASK;	//产生一个新的服务号
-			int hash = handle & (s->slot_size-1);	//新服务信息在数组中的存储位置
-			if (s->slot[hash] == NULL) {	//如果该数组中没有存储服务信息，则将新服务信息存入
-				s->slot[hash] = ctx;
+			int hash = handle & (slot->size-1);	//新服务信息在数组中的存储位置
+			if (slot->ctx[hash] == NULL) {	//如果该数组中没有存储服务信息，则将新服务信息存入
+				slot->ctx[hash] = ctx;
 				s->handle_index = handle + 1;	//用于下一个服务的存储
 
 				rwlock_wunlock(&s->lock);
@@ -53,17 +122,17 @@ skynet_handle_register(struct skynet_context *ctx) {
 				return handle;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);	//检测服务数量是否有超过24位二进制数的上限
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));	//存储服务信息的数组存储空间翻倍
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);	//获得就服务信息的新存储的位置
-			assert(new_slot[hash] == NULL);
-			new_slot[hash] = s->slot[i];	//拷贝到新的数组中
+		assert((slot->size*2 - 1) <= HANDLE_MASK);	//检测服务数量是否有超过24位二进制数的上限
+		struct handle_slot * new_slot = slot_new(slot->size * 2);	//存储服务信息的数组存储空间翻倍
+		for (i=0;i<slot->size;i++) {
+			int hash = skynet_context_handle(slot->ctx[i]) & (new_slot->size - 1);	//获得就服务信息的新存储的位置
+			assert(new_slot->ctx[hash] == NULL);
+			new_slot->ctx[hash] = slot->ctx[i];	//拷贝到新的数组中
 		}
-		skynet_free(s->slot);	//释放旧的数组空间
+		ATOM_SYNC();
 		s->slot = new_slot;
-		s->slot_size *= 2;
+		handle_synchronize(s);	//等待还在读旧数组的线程
+		skynet_free(slot);	//释放旧的数组空间
 	}
 }
 
@@ -75,24 +144,31 @@ skynet_handle_retire(uint32_t handle) {
 
 	rwlock_wlock(&s->lock);
 
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot->ctx[hash];
+	struct handle_name * retire = NULL;
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		slot->ctx[hash] = NULL;
 		ret = 1;
-		int i;
-		int j=0, n=s->name_count;
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-				s->name[j] = s->name[i];
+		if (s->name.count > 0) {	//移除该服务的所有服务名，等没有读者之后再释放
+			struct hashname_table *t = s->name.table;
+			int i;
+			for (i=0; i<t->size; ++i) {
+				struct hashname_node *node = t->slot[i];
+				while (node) {
+					struct hashname_node *next = node->next;
+					struct handle_name *n = (struct handle_name *)node;
+					if (n->handle == handle) {
+						hashname_remove(&s->name, node);
+						n->retire_next = retire;
+						retire = n;
+					}
+					node = next;
+				}
 			}
-			++j;
 		}
-		s->name_count = j;
 	} else {
 		ctx = NULL;
 	}
@@ -100,6 +176,12 @@ skynet_handle_retire(uint32_t handle) {
 	rwlock_wunlock(&s->lock);
 
 	if (ctx) {
+		handle_synchronize(s);	//等待可能已读到ctx但还未增加引用计数的线程
+		while (retire) {
+			struct handle_name *next = retire->retire_next;
+			skynet_free(retire);
+			retire = next;
+		}
 		// release ctx may call skynet_handle_* , so wunlock first.
 		skynet_context_release(ctx);
 	}
@@ -114,13 +196,14 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {	//删除全局服务信息中的所有服务信息
-			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+		for (i=0;i<s->slot->size;i++) {	//删除全局服务信息中的所有服务信息
+			struct handle_reader *r = reader_enter(s);
+			struct handle_slot *slot = s->slot;
+			struct skynet_context * ctx = i < slot->size ? slot->ctx[i] : NULL;
 			uint32_t handle = 0;
 			if (ctx)
 				handle = skynet_context_handle(ctx);	//获得服务名
-			rwlock_runlock(&s->lock);
+			reader_leave(r);
 			if (handle != 0) {
 				if (skynet_handle_retire(handle)) {	//将指定的服务信息从全局的服务信息数字中剔除掉
 					++n;
@@ -138,16 +221,17 @@ skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;		//全局所有的服务信息
 	struct skynet_context * result = NULL;
 
-	rwlock_rlock(&s->lock);
+	struct handle_reader *r = reader_enter(s);	//不加锁
 
-	uint32_t hash = handle & (s->slot_size-1);		//获得服务编号对应的服务信息的存储位置
-	struct skynet_context * ctx = s->slot[hash];	//获得服务信息
+	struct handle_slot *slot = s->slot;
+	uint32_t hash = handle & (slot->size-1);		//获得服务编号对应的服务信息的存储位置
+	struct skynet_context * ctx = slot->ctx[hash];	//获得服务信息
 	if (ctx && skynet_context_handle(ctx) == handle) {
 		result = ctx;
 		skynet_context_grab(result);	//增加服务信息的引用计数
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return result;
 }
@@ -156,83 +240,44 @@ skynet_handle_grab(uint32_t handle) {
 uint32_t 
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
+	size_t sz = strlen(name) + 1;	//包括结尾的0，只匹配完整的名字
+	uint32_t hash = hashname_hash(name, sz);
 
-	rwlock_rlock(&s->lock);
+	struct handle_reader *r = reader_enter(s);	//不加锁
 
 	uint32_t handle = 0;
-
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			handle = n->handle;
-			break;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+	struct hashname_node *node = hashname_find(&s->name, name, sz, hash);
+	if (node) {
+		handle = ((struct handle_name *)node)->handle;
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return handle;
 }
 
-//插入服务名
-static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
-		}
-	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
-}
-
-//按照字典序的顺序存储服务名
+//插入服务名，名字已存在返回NULL
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
-			return NULL;
-		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
+	size_t sz = strlen(name) + 1;
+	uint32_t hash = hashname_hash(name, sz);
+	if (hashname_find(&s->name, name, sz, hash)) {
+		return NULL;
+	}
+	struct handle_name *n = skynet_malloc(sizeof(*n) + sz);
+	memcpy(n->name, name, sz);
+	n->node.name = n->name;
+	n->node.hash = hash;
+	n->handle = handle;
+	n->retire_next = NULL;
+
+	struct hashname_table *old = hashname_insert(&s->name, &n->node);
+	if (old) {
+		handle_synchronize(s);	//等待还在读旧桶数组的线程
+		skynet_free(old);
 	}
-	char * result = skynet_strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
 
-	return result;
+	return n->name;
 }
 
 //插入服务名，并返回服务名指针
@@ -251,17 +296,19 @@ void
 skynet_handle_init(int harbor) {
 	assert(H==NULL);
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;	//存储服务信息数组的大小，随着服务数量的增加会翻倍增加
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));	//分配内存
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	s->slot = slot_new(DEFAULT_SLOT_SIZE);	//存储服务信息数组的大小，随着服务数量的增加会翻倍增加
+	s->epoch = 1;
+	s->reader = NULL;
+	if (pthread_key_create(&s->reader_key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;	//本节点的节点号
 	s->handle_index = 1;	//初始化从slot数组第一个开始存服务信息
-	s->name_cap = 2;		//初始化容量为2，随着服务数量的增加，这个容量值翻倍增加
-	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	hashname_init(&s->name);	//服务名的哈希索引，随着服务名数量的增加翻倍扩容
 
 	H = s;
 
@@ -5,11 +5,22 @@ struct skynet_config {
 	int thread;
 	int harbor;
 	int profile;
+	int steal;
+	int affinity;
+	int timeslice;
+	int timer_tick;
+	int slab;
+	int socket_thread;
+	int socket_uring;
 	const char * daemon;
 	const char * module_path;
 	const char * bootstrap;
 	const char * logger;
 	const char * logservice;
+	const char * socket_cpu;
+	const char * timer_cpu;
+	const char * worker_cpu;
+	int numa;
 };
 
 #define THREAD_WORKER 0		//工作线程
@@ -156,6 +156,17 @@ main(int argc, char *argv[]) {
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
 	config.profile = optboolean("profile", 1);
+	config.steal = optboolean("steal", 0);
+	config.affinity = optboolean("affinity", 0);
+	config.timeslice = optint("timeslice", 0);
+	config.timer_tick = optint("timer_tick", 10);
+	config.slab = optint("slab", 256);
+	config.socket_thread = optint("socket_thread", 1);
+	config.socket_uring = optboolean("socket_uring", 0);
+	config.socket_cpu = optstring("socket_cpu", NULL);
+	config.timer_cpu = optstring("timer_cpu", NULL);
+	config.worker_cpu = optstring("worker_cpu", NULL);
+	config.numa = optboolean("numa", 0);
 
 	lua_close(L);		//消耗上面创建的lua状态机
 
@@ -2,14 +2,24 @@
 #include "skynet_mq.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "atomic.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
 
-#define DEFAULT_QUEUE_SIZE 64
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define MQ_SEGMENT_SIZE 64		//每个消息段可存放的消息数量
 #define MAX_GLOBAL_MQ 0x10000		//暂无调用
 
 // 0 means mq is not in global mq.
@@ -17,73 +27,330 @@
 
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
+#define PARK_SPIN 1024		//工作线程睡眠前自旋检查全局队列的次数
+#define AFFINITY_BACKLOG 4	//上次运行服务的工作线程的本地队列超过这个长度时，服务队列改到其他线程
+#define PRIORITY_BURST 16	//普通优先级的服务队列等待时，最多连续取出的高优先级服务队列数量，避免饿死
+
+struct mq_slot {
+	struct skynet_message message;
+	int ready;						//消息是否已经写入完毕
+};
+
+// The message queue is a linked list of segments. Producers claim a slot by atomic increment of tail,
+// and the only consumer (the worker who owns the queue, see in_global) reads slots in order.
+struct mq_segment {
+	struct mq_segment *next;		//下一个消息段
+	struct mq_segment *retire_next;	//等待回收的消息段链表
+	unsigned int base;				//第一个消息的序号
+	struct mq_slot slot[MQ_SEGMENT_SIZE];
+};
 
 struct message_queue {
-	struct spinlock lock;			//锁
+	struct spinlock lock;			//锁，只用于服务队列的释放
 	uint32_t handle;				//服务handle，用于定位服务，高8位为节点的编号
-	int cap;						//服务队列中消息队列的容量
-	int head;						//服务队列中消息队列的头
-	int tail;						//服务队列中消息队列的尾
 	int release;					//标记是否释放
 	int in_global;					//标记该服务是否在全局队列中
 	int overload;					//记录服务队列中消息超过阈值时的数量
 	int overload_threshold;			//服务队列中消息的上限值，超过将会翻倍
-	struct skynet_message *queue;	//消息队列
+	int priority;					//调度优先级，MQ_PRIORITY_HIGH的服务队列优先被取出
+	int worker;						//上次取出该服务队列的工作线程序号，-1表示没有
+	int schedule;					//被工作线程取出的次数
+	int migrate;					//被与上次不同的工作线程取出的次数
+	unsigned int head;				//下一条要取出的消息的序号，只由消费者修改
+	struct mq_segment *head_seg;	//消费者所在的消息段
+	struct mq_segment *retired;		//已消费完，等待回收的消息段
+	struct mq_segment *pending;		//等待旧epoch中的生产者离开后回收的消息段
+	unsigned int tail;				//下一条写入的消息的序号，生产者原子递增
+	struct mq_segment *tail_seg;	//生产者所在的消息段
+	struct mq_segment *spare;		//备用的空消息段，避免频繁分配
+	unsigned int epoch;				//回收消息段时递增
+	int active[2];					//各个epoch中正在写入的生产者数量
 	struct message_queue *next;		//指向下一个服务
 };
 
+// one FIFO lane for each priority
 struct global_queue {
-	struct message_queue *head;		//全局队列头
-	struct message_queue *tail;		//全局队列尾
+	struct message_queue *head[MQ_PRIORITY_COUNT];		//全局队列头
+	struct message_queue *tail[MQ_PRIORITY_COUNT];		//全局队列尾
+	int burst;						//连续取出的高优先级服务队列数量
+	int length;						//服务队列的数量
 	struct spinlock lock;			//锁
 };
 
+// local run queue of each worker, padding to avoid false sharing
+union local_queue {
+	struct global_queue q;
+	char padding[64];
+};
+
+// Idle workers park here, skynet_globalmq_push wakes one of them directly unless one is spinning,
+// and the last spinner which finds work wakes another one, so the parked workers join a steady load.
+struct parking_lot {
+	int seq;					//每次唤醒时递增，睡眠前记录，避免丢失唤醒
+	int parked;					//睡眠中的工作线程数量
+	int spinning;				//睡眠前自旋中的工作线程数量，它们会自己取到新的服务队列
+	int spin;					//自旋次数，单核时不自旋
+	int exit;					//标记退出，不再睡眠
+#if !defined(__linux__)
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
 static struct global_queue *Q = NULL;
+static struct parking_lot P;
 
-//将服务队列添加到全局队列
-void 
-skynet_globalmq_push(struct message_queue * queue) {
-	struct global_queue *q= Q;
+static union local_queue *LQ = NULL;	//每个工作线程的本地队列，为NULL表示使用单一的全局队列
+static int LQ_COUNT = 0;				//本地队列的数量，即工作线程数量
+static unsigned int LQ_NEXT = 0;		//非工作线程轮流将服务队列压入各个本地队列
+static pthread_key_t LQ_KEY;			//与工作线程关联的本地队列序号（序号+1）
+static int AFFINITY = 0;				//是否优先将服务队列放回上次运行它的工作线程
 
+static void
+queue_push(struct global_queue *q, struct message_queue *queue) {
 	SPIN_LOCK(q)
 	assert(queue->next == NULL);
-	if(q->tail) {
-		q->tail->next = queue;
-		q->tail = queue;
+	int lane = queue->priority;
+	if(q->tail[lane]) {
+		q->tail[lane]->next = queue;
+		q->tail[lane] = queue;
 	} else {
-		q->head = q->tail = queue;
+		q->head[lane] = q->tail[lane] = queue;
 	}
+	++q->length;
 	SPIN_UNLOCK(q)
 }
 
-//从全局队列中取出服务并删除
-struct message_queue * 
-skynet_globalmq_pop() {
-	struct global_queue *q = Q;
-
+//优先取出高优先级的服务队列，但连续取出PRIORITY_BURST个后，让等待中的普通服务队列先出
+static struct message_queue *
+queue_pop(struct global_queue *q) {
 	SPIN_LOCK(q)
-	struct message_queue *mq = q->head;
+	int lane = MQ_PRIORITY_NORMAL;
+	if (q->head[MQ_PRIORITY_HIGH]) {
+		if (q->burst < PRIORITY_BURST || q->head[MQ_PRIORITY_NORMAL] == NULL) {
+			lane = MQ_PRIORITY_HIGH;
+		}
+	}
+	struct message_queue *mq = q->head[lane];
 	if(mq) {
-		q->head = mq->next;
-		if(q->head == NULL) {
-			assert(mq == q->tail);
-			q->tail = NULL;
+		q->head[lane] = mq->next;
+		if(q->head[lane] == NULL) {
+			assert(mq == q->tail[lane]);
+			q->tail[lane] = NULL;
 		}
 		mq->next = NULL;
+		--q->length;
+		if (lane == MQ_PRIORITY_HIGH) {
+			++q->burst;
+		} else {
+			q->burst = 0;
+		}
 	}
 	SPIN_UNLOCK(q)
 
 	return mq;
 }
 
+static inline int
+queue_empty(struct global_queue *q) {
+	return q->head[MQ_PRIORITY_NORMAL] == NULL && q->head[MQ_PRIORITY_HIGH] == NULL;
+}
+
+#if defined(__linux__)
+
+static inline void
+park_wait(int seq) {
+	syscall(SYS_futex, &P.seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+}
+
+static inline void
+park_wake(int all) {
+	syscall(SYS_futex, &P.seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+}
+
+#else
+
+static inline void
+park_wait(int seq) {
+	pthread_mutex_lock(&P.mutex);
+	if (P.seq == seq) {
+		pthread_cond_wait(&P.cond, &P.mutex);
+	}
+	pthread_mutex_unlock(&P.mutex);
+}
+
+static inline void
+park_wake(int all) {
+	pthread_mutex_lock(&P.mutex);
+	if (all) {
+		pthread_cond_broadcast(&P.cond);
+	} else {
+		pthread_cond_signal(&P.cond);
+	}
+	pthread_mutex_unlock(&P.mutex);
+}
+
+#endif
+
+static inline void
+cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	ATOM_SYNC();
+#endif
+}
+
+//唤醒睡眠中的工作线程
+static void
+unpark(int all) {
+	ATOM_INC(&P.seq);
+	park_wake(all);
+}
+
+//全局队列（或任意一个本地队列）中是否有服务队列，不加锁
+static int
+globalmq_ready() {
+	if (LQ == NULL) {
+		return !queue_empty(Q);
+	}
+	int i;
+	for (i=0;i<LQ_COUNT;i++) {
+		if (!queue_empty(&LQ[i].q)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//获得当前工作线程的本地队列序号，非工作线程返回-1
+static inline int
+local_id() {
+	return (int)(intptr_t)pthread_getspecific(LQ_KEY) - 1;
+}
+
+//将服务队列添加到全局队列
+void 
+skynet_globalmq_push(struct message_queue * queue) {
+	if (LQ == NULL) {
+		queue_push(Q, queue);
+	} else {
+		int id = queue->worker;
+		if (!AFFINITY || id < 0 || LQ[id].q.length >= AFFINITY_BACKLOG) {	//上次运行的工作线程积压太多时才迁移
+			id = local_id();
+			if (id < 0) {	//套接字、定时器等线程没有本地队列，轮流分配给各个工作线程
+				id = ATOM_FINC(&LQ_NEXT) % LQ_COUNT;
+			}
+		}
+		queue_push(&LQ[id].q, queue);
+	}
+	ATOM_SYNC();
+	if (P.parked > 0 && P.spinning == 0) {		//有工作线程在睡眠且没有线程在自旋，直接唤醒一个
+		unpark(0);
+	}
+}
+
+//从全局队列中取出服务并删除
+struct message_queue * 
+skynet_globalmq_pop() {
+	if (LQ == NULL) {
+		return queue_pop(Q);
+	}
+	int id = local_id();
+	if (id < 0) {
+		id = 0;
+	}
+	struct message_queue *mq = queue_pop(&LQ[id].q);
+	int i;
+	for (i=1;mq == NULL && i<LQ_COUNT;i++) {	//本地队列为空，从其他工作线程的本地队列中窃取
+		struct global_queue *victim = &LQ[(id + i) % LQ_COUNT].q;
+		if (queue_empty(victim)) {		//不加锁的预判，避免无谓的锁竞争
+			continue;
+		}
+		mq = queue_pop(victim);
+	}
+	if (mq) {	//此时只有当前工作线程持有该服务队列
+		++mq->schedule;
+		if (mq->worker >= 0 && mq->worker != id) {
+			++mq->migrate;
+		}
+		mq->worker = id;
+	}
+	return mq;
+}
+
+//全局队列为空时工作线程调用，先自旋一段时间，仍没有服务队列则睡眠直到被唤醒，允许虚假唤醒
+void
+skynet_globalmq_park() {
+	int i;
+	ATOM_INC(&P.spinning);
+	for (i=0;i<P.spin;i++) {
+		if (globalmq_ready() || P.exit) {
+			//最后一个自旋的线程找到了服务队列，把唤醒传给一个睡眠的线程去自旋，
+			//否则持续的负载下只有自旋的线程能取到新的服务队列，其他线程一直睡眠
+			if (ATOM_DEC(&P.spinning) == 0 && P.parked > 0 && !P.exit) {
+				unpark(0);
+			}
+			return;
+		}
+		cpu_relax();
+	}
+	ATOM_DEC(&P.spinning);
+	int seq = P.seq;
+	ATOM_INC(&P.parked);
+	// check again after parked is visible, skynet_globalmq_push either sees it or pushes before this check
+	if (!globalmq_ready() && !P.exit) {
+		park_wait(seq);
+	}
+	ATOM_DEC(&P.parked);
+}
+
+//唤醒所有睡眠的工作线程，并不再睡眠
+void
+skynet_globalmq_exit() {
+	P.exit = 1;
+	unpark(1);
+}
+
+//将当前线程绑定为第id个工作线程，使用其本地队列
+void
+skynet_globalmq_worker(int id) {
+	if (LQ) {
+		assert(id >= 0 && id < LQ_COUNT);
+		pthread_setspecific(LQ_KEY, (void *)(intptr_t)(id + 1));
+	}
+}
+
+//分配一个消息段，优先使用备用的消息段
+static struct mq_segment *
+segment_new(struct message_queue *q, unsigned int base) {
+	struct mq_segment *seg = __sync_lock_test_and_set(&q->spare, NULL);
+	if (seg == NULL) {
+		seg = skynet_malloc(sizeof(*seg));
+	}
+	seg->next = NULL;
+	seg->retire_next = NULL;
+	seg->base = base;
+	int i;
+	for (i=0;i<MQ_SEGMENT_SIZE;i++) {
+		seg->slot[i].ready = 0;
+	}
+	return seg;
+}
+
+//回收一个消息段，此时不能再有生产者引用它
+static void
+segment_recycle(struct message_queue *q, struct mq_segment *seg) {
+	if (q->spare != NULL || !ATOM_CAS_POINTER(&q->spare, NULL, seg)) {
+		skynet_free(seg);
+	}
+}
+
 //创建服务队列
 struct message_queue * 
 skynet_mq_create(uint32_t handle) {
 	struct message_queue *q = skynet_malloc(sizeof(*q));
 	q->handle = handle;		//通过此变量来定位服务，相当于服务的地址，高8位为节点的编号
-	q->cap = DEFAULT_QUEUE_SIZE;	//默认服务队列容量大小为64
-	q->head = 0;					//初始化队列的头
-	q->tail = 0;					//初始化队列的尾
 	SPIN_INIT(q)
 	// When the queue is create (always between service create and service init) ,
 	// set in_global flag to avoid push it to global queue .
@@ -92,18 +359,46 @@ skynet_mq_create(uint32_t handle) {
 	q->release = 0;					//标记是否是否服务队列
 	q->overload = 0;				//记录服务队列中消息超过阈值时的数量
 	q->overload_threshold = MQ_OVERLOAD;	//服务队列中加载消息数量的阈值
-	q->queue = skynet_malloc(sizeof(struct skynet_message) * q->cap);
+	q->priority = MQ_PRIORITY_NORMAL;
+	q->worker = -1;
+	q->schedule = 0;
+	q->migrate = 0;
+	q->spare = NULL;
+	q->head = 0;					//初始化队列的头
+	q->tail = 0;					//初始化队列的尾
+	q->head_seg = q->tail_seg = segment_new(q, 0);
+	q->retired = NULL;
+	q->pending = NULL;
+	q->epoch = 0;
+	q->active[0] = q->active[1] = 0;
 	q->next = NULL;
 
 	return q;
 }
 
+static void
+free_segments(struct mq_segment *seg) {
+	while (seg) {
+		struct mq_segment *next = seg->retire_next;
+		skynet_free(seg);
+		seg = next;
+	}
+}
+
 //释放服务队列
 static void 
 _release(struct message_queue *q) {
 	assert(q->next == NULL);
 	SPIN_DESTROY(q)
-	skynet_free(q->queue);
+	struct mq_segment *seg = q->head_seg;
+	while (seg) {
+		struct mq_segment *next = seg->next;
+		skynet_free(seg);
+		seg = next;
+	}
+	free_segments(q->retired);
+	free_segments(q->pending);
+	skynet_free(q->spare);
 	skynet_free(q);
 }
 
@@ -113,21 +408,29 @@ skynet_mq_handle(struct message_queue *q) {
 	return q->handle;
 }
 
-//获得服务队列中消息队列的长度
+//设置服务队列的调度优先级，下次进入全局队列时生效，priority小于0时只获取，返回当前的优先级
 int
-skynet_mq_length(struct message_queue *q) {
-	int head, tail,cap;
-
-	SPIN_LOCK(q)
-	head = q->head;
-	tail = q->tail;
-	cap = q->cap;
-	SPIN_UNLOCK(q)
-	
-	if (head <= tail) {
-		return tail - head;
+skynet_mq_priority(struct message_queue *q, int priority) {
+	if (priority >= 0) {
+		assert(priority < MQ_PRIORITY_COUNT);
+		q->priority = priority;
 	}
-	return tail + cap - head;
+	return q->priority;
+}
+
+//获得服务队列被工作线程取出的次数，及其中换到其他工作线程的次数，只在steal模式下统计
+void
+skynet_mq_schedule(struct message_queue *q, int *schedule, int *migrate) {
+	*schedule = q->schedule;
+	*migrate = q->migrate;
+}
+
+//获得服务队列中消息队列的长度，包括正在写入的消息
+int
+skynet_mq_length(struct message_queue *q) {
+	unsigned int head = q->head;
+	unsigned int tail = q->tail;
+	return (int)(tail - head);
 }
 
 //获得消息数量超出阈值时的消息数量，并清零记录值
@@ -141,90 +444,172 @@ skynet_mq_overload(struct message_queue *q) {
 	return 0;
 }
 
-//从服务队列中取出消息，取出返回0，否则为1
-int
-skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
-	int ret = 1;
-	SPIN_LOCK(q)
+//生产者进入当前epoch，在此期间它引用的消息段不会被回收
+static inline unsigned int
+producer_enter(struct message_queue *q) {
+	for (;;) {
+		unsigned int epoch = q->epoch;
+		ATOM_INC(&q->active[epoch & 1]);
+		if (q->epoch == epoch) {
+			return epoch;
+		}
+		// the consumer has retired segments in the meantime, retry in the new epoch
+		ATOM_DEC(&q->active[epoch & 1]);
+	}
+}
 
-	if (q->head != q->tail) {
-		*message = q->queue[q->head++];
-		ret = 0;
-		int head = q->head;
-		int tail = q->tail;
-		int cap = q->cap;
+static inline void
+producer_leave(struct message_queue *q, unsigned int epoch) {
+	ATOM_DEC(&q->active[epoch & 1]);
+}
 
-		if (head >= cap) {
-			q->head = head = 0;
+//回收已消费完的消息段，只由消费者调用
+static void
+reclaim(struct message_queue *q) {
+	if (q->pending && q->active[(q->epoch - 1) & 1] == 0) {	//上一个epoch的生产者都已离开
+		struct mq_segment *seg = q->pending;
+		q->pending = NULL;
+		while (seg) {
+			struct mq_segment *next = seg->retire_next;
+			segment_recycle(q, seg);
+			seg = next;
 		}
-		int length = tail - head;	//记录服务队列中消息的数量
-		if (length < 0) {
-			length += cap;
+	}
+	if (q->pending == NULL && q->retired) {
+		q->pending = q->retired;
+		q->retired = NULL;
+		ATOM_INC(&q->epoch);	//新来的生产者不会再看到pending中的消息段
+		if (q->active[(q->epoch - 1) & 1] == 0) {
+			reclaim(q);
 		}
-		while (length > q->overload_threshold) {	//消息数量超过阈值
-			q->overload = length;		//记录超过阈值时的消息数量
-			q->overload_threshold *= 2;		//阈值翻倍
+	}
+}
+
+//获得下一条可取出的消息所在的位置，没有已写入完毕的消息返回NULL
+static struct mq_slot *
+head_slot(struct message_queue *q) {
+	struct mq_segment *seg = q->head_seg;
+	unsigned int idx = q->head - seg->base;
+	if (idx == MQ_SEGMENT_SIZE) {	//当前消息段已消费完，移到下一个消息段
+		struct mq_segment *next = seg->next;
+		if (next == NULL) {
+			return NULL;
 		}
-	} else {
-		// reset overload_threshold when queue is empty
-		q->overload_threshold = MQ_OVERLOAD;
+		ATOM_CAS_POINTER(&q->tail_seg, seg, next);	//保证生产者不会再取得这个消息段
+		q->head_seg = next;
+		seg->retire_next = q->retired;
+		q->retired = seg;
+		reclaim(q);
+		seg = next;
+		idx = 0;
+	}
+	struct mq_slot *slot = &seg->slot[idx];
+	if (!slot->ready) {
+		return NULL;
 	}
+	ATOM_SYNC();
+	return slot;
+}
 
-	if (ret) {			//服务队列中没有消息时，则将该服务队列从全局队列中踢出，设置标志位
+//从服务队列中一次取出最多max条消息，返回取出的数量，返回0表示服务队列为空
+int
+skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int max) {
+	struct mq_slot *slot = head_slot(q);
+	if (slot == NULL) {
+		// reset overload_threshold when queue is empty
+		q->overload_threshold = MQ_OVERLOAD;
+		reclaim(q);
+		//服务队列中没有消息时，则将该服务队列从全局队列中踢出，设置标志位
 		q->in_global = 0;
+		ATOM_SYNC();
+		// A producer may publish a message before it sees in_global == 0, take it back if nobody else does.
+		slot = head_slot(q);
+		if (slot == NULL || !ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
+			return 0;
+		}
+	}
+	int n = 0;
+	do {
+		msgs[n++] = slot->message;
+		++q->head;
+	} while (n < max && (slot = head_slot(q)));
+
+	int length = (int)(q->tail - q->head);	//记录服务队列中消息的数量
+	while (length > q->overload_threshold) {	//消息数量超过阈值
+		q->overload = length;		//记录超过阈值时的消息数量
+		q->overload_threshold *= 2;		//阈值翻倍
 	}
-	
-	SPIN_UNLOCK(q)
 
-	return ret;
+	return n;
 }
 
-//扩充服务队列的容量
-static void
-expand_queue(struct message_queue *q) {
-	struct skynet_message *new_queue = skynet_malloc(sizeof(struct skynet_message) * q->cap * 2);
-	int i;
-	for (i=0;i<q->cap;i++) {
-		new_queue[i] = q->queue[(q->head + i) % q->cap];
-	}
-	q->head = 0;
-	q->tail = q->cap;
-	q->cap *= 2;
-	
-	skynet_free(q->queue);
-	q->queue = new_queue;
+//从服务队列中取出消息，取出返回0，否则为1
+int
+skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
+	return skynet_mq_pop_batch(q, message, 1) == 0;
 }
 
-//将消息添加到服务队列
+//将消息添加到服务队列，不加锁，消息段写满时链接一个新的消息段
 void 
 skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
 	assert(message);
-	SPIN_LOCK(q)
-
-	q->queue[q->tail] = *message;
-	if (++ q->tail >= q->cap) {
-		q->tail = 0;
-	}
-
-	if (q->head == q->tail) {
-		expand_queue(q);	//扩充消息队列的容量
+	unsigned int epoch = producer_enter(q);
+	struct mq_segment *seg = q->tail_seg;	// must be read before claiming the slot, so seg->base <= pos
+	unsigned int pos = ATOM_FINC(&q->tail);
+	while (pos - seg->base >= MQ_SEGMENT_SIZE) {
+		struct mq_segment *next = seg->next;
+		if (next == NULL) {
+			next = segment_new(q, seg->base + MQ_SEGMENT_SIZE);
+			if (!ATOM_CAS_POINTER(&seg->next, NULL, next)) {
+				segment_recycle(q, next);	//其他生产者已经链接了新的消息段
+				next = seg->next;
+			}
+		}
+		ATOM_CAS_POINTER(&q->tail_seg, seg, next);
+		seg = next;
 	}
-
-	if (q->in_global == 0) {	//如果服务队列不在全局队列中，则将其添加到全局队列
-		q->in_global = MQ_IN_GLOBAL;	//标记为在全局队列中
+	struct mq_slot *slot = &seg->slot[pos - seg->base];
+	slot->message = *message;
+	ATOM_SYNC();
+	slot->ready = 1;
+	producer_leave(q, epoch);
+
+	//如果服务队列不在全局队列中，则将其添加到全局队列
+	if (q->in_global == 0 && ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
 		skynet_globalmq_push(q);	//将服务队列添加到全局队列中
 	}
-	
-	SPIN_UNLOCK(q)
 }
 
-//初始化全局队列
+//初始化全局队列，local大于0时为每个工作线程创建本地队列，并在本地队列为空时从其他线程窃取
+//affinity表示服务队列优先放回上次运行它的工作线程的本地队列
 void 
-skynet_mq_init() {
+skynet_mq_init(int local, int affinity) {
 	struct global_queue *q = skynet_malloc(sizeof(*q));		//为全局队列分配内存
 	memset(q,0,sizeof(*q));
 	SPIN_INIT(q);
 	Q=q;
+
+	memset(&P, 0, sizeof(P));
+	P.spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? PARK_SPIN : 0;
+#if !defined(__linux__)
+	pthread_mutex_init(&P.mutex, NULL);
+	pthread_cond_init(&P.cond, NULL);
+#endif
+
+	if (local > 0) {
+		if (pthread_key_create(&LQ_KEY, NULL)) {
+			fprintf(stderr, "pthread_key_create failed");
+			exit(1);
+		}
+		LQ = skynet_malloc(local * sizeof(*LQ));
+		memset(LQ, 0, local * sizeof(*LQ));
+		int i;
+		for (i=0;i<local;i++) {
+			SPIN_INIT(&LQ[i].q);
+		}
+		LQ_COUNT = local;
+		AFFINITY = affinity;
+	}
 }
 
 //标记服务队列为释放
@@ -233,7 +618,7 @@ skynet_mq_mark_release(struct message_queue *q) {
 	SPIN_LOCK(q)
 	assert(q->release == 0);
 	q->release = 1;
-	if (q->in_global != MQ_IN_GLOBAL) {
+	if (ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL)) {
 		skynet_globalmq_push(q);
 	}
 	SPIN_UNLOCK(q)
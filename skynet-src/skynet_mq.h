@@ -4,22 +4,41 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+// a payload shorter than MESSAGE_INLINE_SIZE (with the ending zero) can be stored in the message itself
+#define MESSAGE_INLINE_SIZE 16
+
 //消息的结构
 struct skynet_message {
 	uint32_t source;	//消息源，定位到发消息的服务
 	int session;		//用于接收消息响应时，定位到是响应哪一条消息，由发送消息的服务生成
-	void * data;		//消息内容
-	size_t sz;		//高8位为type，低24位为消息大小，所以消息最大为16M
+	size_t sz;		//高8位为type，接下来的2位为MESSAGE_SHARED和MESSAGE_INLINE标记，其余低位为消息大小，32位系统上消息最大为4M
+	uint32_t stamp;	//消息入队的时间，单位微秒，开启profile时才记录，0表示没有记录
+	union {
+		void * data;		//消息内容
+		char inline_data[MESSAGE_INLINE_SIZE];	//sz中有MESSAGE_INLINE标记时，消息内容直接存放在这里
+	};
 };
 
 // type is encoding in skynet_message.sz high 8bit
-#define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
+// and the next bits mark a shared (reference counted) payload, see skynet_shared_new,
+// or a payload stored in skynet_message.inline_data.
+// The size takes the remaining low bits : 54 bits on 64-bit systems, 22 bits (up to 4M) on 32-bit systems
+#define MESSAGE_TYPE_MASK (SIZE_MAX >> 10)
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)		//24
+#define MESSAGE_SHARED ((size_t)1 << (MESSAGE_TYPE_SHIFT - 1))
+#define MESSAGE_INLINE ((size_t)1 << (MESSAGE_TYPE_SHIFT - 2))
+
+#define MQ_PRIORITY_NORMAL 0
+#define MQ_PRIORITY_HIGH 1
+#define MQ_PRIORITY_COUNT 2
 
 struct message_queue;
 
 void skynet_globalmq_push(struct message_queue * queue);
 struct message_queue * skynet_globalmq_pop(void);
+void skynet_globalmq_worker(int id);
+void skynet_globalmq_park(void);	// wait until the global mq is not empty (may return spuriously)
+void skynet_globalmq_exit(void);	// wake up all parked workers
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -28,15 +47,21 @@ typedef void (*message_drop)(struct skynet_message *, void *);
 
 void skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud);
 uint32_t skynet_mq_handle(struct message_queue *);
+// priority takes effect the next time the queue is pushed into the global mq, -1 for query only
+int skynet_mq_priority(struct message_queue *q, int priority);
+// the number of times the queue is scheduled, and how many of them moved it to another worker
+void skynet_mq_schedule(struct message_queue *q, int *schedule, int *migrate);
 
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
+// return the number of messages popped (at most max), 0 for empty
+int skynet_mq_pop_batch(struct message_queue *q, struct skynet_message *msgs, int max);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
 int skynet_mq_overload(struct message_queue *q);
 
-void skynet_mq_init();
+void skynet_mq_init(int local, int affinity);	// local > 0 : one run queue per worker with work stealing
 
 #endif
@@ -0,0 +1,175 @@
+#include "skynet.h"
+
+#include "skynet_pool.h"
+#include "spinlock.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGAZINE_SIZE 64
+
+struct magazine {
+	struct magazine *next;			//仓库中的下一个弹夹
+	int n;							//弹夹中空闲对象的数量
+	void *obj[MAGAZINE_SIZE];		//空闲对象
+};
+
+struct pool_cache {
+	struct magazine *loaded;		//当前使用的弹夹
+	struct magazine *prev;			//备用的弹夹，为空或者满
+	struct pool_cache *next;		//所有线程缓存组成的链表，用于统计
+};
+
+struct skynet_pool {
+	size_t size;					//对象的大小
+	pthread_key_t key;				//与线程关联的缓存
+	struct spinlock lock;			//保护下面的仓库
+	struct magazine *full;			//仓库中满的弹夹
+	struct magazine *empty;			//仓库中空的弹夹
+	size_t full_count;				//仓库中满的弹夹数量
+	size_t total;					//分配过的对象总数
+	struct pool_cache *cache;		//所有线程的缓存
+	skynet_pool_chunk chunk;		//分配一批对象的内存，为NULL时使用skynet_malloc
+	void *chunk_ud;
+};
+
+static struct magazine *
+magazine_new() {
+	struct magazine *m = skynet_malloc(sizeof(*m));
+	m->next = NULL;
+	m->n = 0;
+	return m;
+}
+
+//获得本线程的缓存，第一次使用时创建
+static struct pool_cache *
+pool_cache(struct skynet_pool *p) {
+	struct pool_cache *c = pthread_getspecific(p->key);
+	if (c == NULL) {
+		c = skynet_malloc(sizeof(*c));
+		c->loaded = magazine_new();
+		c->prev = magazine_new();
+		SPIN_LOCK(p)
+		c->next = p->cache;
+		p->cache = c;
+		SPIN_UNLOCK(p)
+		pthread_setspecific(p->key, c);
+	}
+	return c;
+}
+
+static void *
+default_chunk(void *ud, size_t sz) {
+	return skynet_malloc(sz);
+}
+
+struct skynet_pool *
+skynet_pool_new(size_t size) {
+	return skynet_pool_newchunk(size, default_chunk, NULL);
+}
+
+struct skynet_pool *
+skynet_pool_newchunk(size_t size, skynet_pool_chunk chunk, void *ud) {
+	struct skynet_pool *p = skynet_malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	if (size < sizeof(void *)) {
+		size = sizeof(void *);
+	}
+	p->size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);	//按指针大小对齐
+	if (pthread_key_create(&p->key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	SPIN_INIT(p)
+	p->chunk = chunk;
+	p->chunk_ud = ud;
+	return p;
+}
+
+void *
+skynet_pool_alloc(struct skynet_pool *p) {
+	struct pool_cache *c = pool_cache(p);
+	if (c->loaded->n == 0) {
+		struct magazine *m = c->loaded;
+		if (c->prev->n > 0) {	//备用弹夹是满的，交换
+			c->loaded = c->prev;
+			c->prev = m;
+		} else {
+			SPIN_LOCK(p)
+			if (p->full) {	//用一个空的弹夹从仓库换一个满的
+				struct magazine *full = p->full;
+				p->full = full->next;
+				--p->full_count;
+				m->next = p->empty;
+				p->empty = m;
+				c->loaded = full;
+			} else {	//仓库也没有，新分配一批对象
+				char *chunk = p->chunk(p->chunk_ud, p->size * MAGAZINE_SIZE);
+				if (chunk == NULL) {
+					SPIN_UNLOCK(p)
+					return NULL;
+				}
+				int i;
+				for (i=0;i<MAGAZINE_SIZE;i++) {
+					m->obj[i] = chunk + i * p->size;
+				}
+				m->n = MAGAZINE_SIZE;
+				p->total += MAGAZINE_SIZE;
+			}
+			SPIN_UNLOCK(p)
+		}
+	}
+	struct magazine *m = c->loaded;
+	return m->obj[--m->n];
+}
+
+void
+skynet_pool_free(struct skynet_pool *p, void *ptr) {
+	struct pool_cache *c = pool_cache(p);
+	if (c->loaded->n == MAGAZINE_SIZE) {
+		struct magazine *m = c->loaded;
+		if (c->prev->n == 0) {	//备用弹夹是空的，交换
+			c->loaded = c->prev;
+			c->prev = m;
+		} else {
+			//把满的备用弹夹放入仓库，换一个空的
+			struct magazine *full = c->prev;
+			SPIN_LOCK(p)
+			full->next = p->full;
+			p->full = full;
+			++p->full_count;
+			struct magazine *empty = p->empty;
+			if (empty) {
+				p->empty = empty->next;
+			}
+			SPIN_UNLOCK(p)
+			if (empty == NULL) {
+				empty = magazine_new();
+			}
+			empty->n = 0;
+			c->prev = m;
+			c->loaded = empty;
+		}
+	}
+	struct magazine *m = c->loaded;
+	m->obj[m->n++] = ptr;
+}
+
+//统计信息，线程缓存的数量没有加锁，只是近似值
+void
+skynet_pool_stat(struct skynet_pool *p, struct skynet_pool_stat *st) {
+	SPIN_LOCK(p)
+	st->size = p->size;
+	st->total = p->total;
+	st->depot = p->full_count * MAGAZINE_SIZE;
+	st->cached = 0;
+	struct pool_cache *c;
+	for (c=p->cache;c;c=c->next) {
+		st->cached += c->loaded->n + c->prev->n;
+	}
+	SPIN_UNLOCK(p)
+	size_t free = st->depot + st->cached;
+	st->used = st->total > free ? st->total - free : 0;
+}
@@ -0,0 +1,30 @@
+#ifndef SKYNET_POOL_H
+#define SKYNET_POOL_H
+
+#include <stddef.h>
+
+// A pool of fixed size objects. Each thread keeps two magazines of free objects,
+// and exchanges full/empty magazines with a shared depot, so alloc and free are O(1)
+// and only touch the depot lock once per magazine. Memory is never returned to the system.
+
+struct skynet_pool;
+
+struct skynet_pool_stat {
+	size_t size;		//对象的大小
+	size_t total;		//分配过的对象总数
+	size_t used;		//正在使用的对象数量
+	size_t cached;		//线程缓存中的空闲对象数量
+	size_t depot;		//公共仓库中的空闲对象数量
+};
+
+// Allocates the memory of a new batch of objects, returns NULL if out of memory.
+typedef void * (*skynet_pool_chunk)(void *ud, size_t sz);
+
+struct skynet_pool * skynet_pool_new(size_t size);
+struct skynet_pool * skynet_pool_newchunk(size_t size, skynet_pool_chunk chunk, void *ud);
+// returns NULL only if the chunk allocator fails
+void * skynet_pool_alloc(struct skynet_pool *p);
+void skynet_pool_free(struct skynet_pool *p, void *ptr);
+void skynet_pool_stat(struct skynet_pool *p, struct skynet_pool_stat *st);
+
+#endif
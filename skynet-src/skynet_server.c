@@ -10,9 +10,11 @@
 #include "skynet_monitor.h"
 #include "skynet_imp.h"
 #include "skynet_log.h"
+#include "skynet_slab.h"
 #include "skynet_timer.h"
 #include "spinlock.h"
 #include "atomic.h"
+#include "histogram.h"
 
 #include <pthread.h>
 
@@ -22,6 +24,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 
+#define MESSAGE_BATCH 64	//每次从服务队列中取出的最大消息数量
+
 #ifdef CALLING_CHECK
 
 #define CHECKCALLING_BEGIN(ctx) if (!(spinlock_trylock(&ctx->calling))) { assert(0); }
@@ -58,6 +62,10 @@ struct skynet_context {
 	bool init;							//服务是否初始化
 	bool endless;						//标记服务是否陷入死循环
 	bool profile;						//是否开启CPU耗时监测
+	bool timer_coalesce;				//是否合并投递定时消息
+	bool cb_inline;						//回调函数不会保留消息内容，内嵌或共享的消息内容可以直接交给回调函数
+	struct histogram wait;				//消息在服务队列中等待的时长分布，单位微秒
+	struct histogram exec;				//服务处理消息消耗CPU时间的分布，单位微秒
 
 	CHECKCALLING_DECL					//锁
 };
@@ -68,6 +76,7 @@ struct skynet_node {
 	uint32_t monitor_exit;
 	pthread_key_t handle_key;	//与线程相关联的handle
 	bool profile;	//是否开启CPU耗时监测 默认开启
+	int timeslice;	//每次处理服务队列消息的目标时长，单位微秒，0表示使用固定的weight
 };
 
 static struct skynet_node G_NODE;
@@ -114,6 +123,57 @@ id_to_hex(char * str, uint32_t id) {
 	str[9] = '\0';
 }
 
+// The header of a shared payload, msg points just after it.
+struct shared_buffer {
+	int ref;		//引用计数，每个持有该消息的服务一个
+	int padding;
+	size_t sz;		//消息大小
+};
+
+//新建一个引用计数为1的共享消息内容，msg不为NULL时拷贝进来
+void *
+skynet_shared_new(const void * msg, size_t sz) {
+	struct shared_buffer * sb = skynet_malloc(sizeof(*sb) + sz + 1);
+	sb->ref = 1;
+	sb->padding = 0;
+	sb->sz = sz;
+	char * data = (char *)(sb + 1);
+	if (msg) {
+		memcpy(data, msg, sz);
+	}
+	data[sz] = '\0';
+	return data;
+}
+
+//增加共享消息内容的引用计数
+void
+skynet_shared_retain(void * msg) {
+	struct shared_buffer * sb = (struct shared_buffer *)msg - 1;
+	ATOM_INC(&sb->ref);
+}
+
+//减少共享消息内容的引用计数，为0时释放
+void
+skynet_shared_release(void * msg) {
+	struct shared_buffer * sb = (struct shared_buffer *)msg - 1;
+	if (ATOM_DEC(&sb->ref) == 0) {
+		skynet_free(sb);
+	}
+}
+
+//释放消息的内容，共享的消息内容只减少引用计数，内嵌的消息内容不需要释放
+static inline void
+message_free(struct skynet_message *msg) {
+	if (msg->sz & MESSAGE_INLINE) {
+		return;
+	}
+	if (msg->sz & MESSAGE_SHARED) {
+		skynet_shared_release(msg->data);
+	} else {
+		skynet_free(msg->data);
+	}
+}
+
 struct drop_t {
 	uint32_t handle;
 };
@@ -122,7 +182,7 @@ struct drop_t {
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	message_free(msg);
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
@@ -158,6 +218,10 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->cpu_start = 0;			//本线程到当前代码系统CPU花费的时间
 	ctx->message_count = 0;		//记录处理消息的数量
 	ctx->profile = G_NODE.profile;	//是否开启CPU耗时监测
+	ctx->timer_coalesce = false;
+	ctx->cb_inline = false;
+	histogram_init(&ctx->wait);
+	histogram_init(&ctx->exec);
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	//存储带有节点号的服务号
 	ctx->handle = skynet_handle_register(ctx);	//将服务信息存储到全局服务信息中，并产生一个定位服务的编号
@@ -245,6 +309,7 @@ skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	if (ctx == NULL) {
 		return -1;
 	}
+	message->stamp = ctx->profile ? (uint32_t)skynet_monotonic_time() : 0;	//记录入队时间
 	skynet_mq_push(ctx->queue, message);	//将消息添加到服务队列
 	skynet_context_release(ctx);	//递减服务信息的引用计数，如果计数为0则释放
 
@@ -280,21 +345,46 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));	//将handle与线程关联
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;		//获得消息类型
 	size_t sz = msg->sz & MESSAGE_TYPE_MASK;		//获得消息的大小
+	void * data = msg->data;
+	if (msg->sz & MESSAGE_INLINE) {
+		if (ctx->cb_inline) {
+			data = msg->inline_data;	//指向工作线程中消息的副本，只在回调期间有效
+		} else {	//回调函数可能保留消息内容，需要一份普通的拷贝
+			char * copy = skynet_slab_alloc(sz+1);
+			memcpy(copy, msg->inline_data, sz+1);
+			msg->data = copy;
+			msg->sz &= ~MESSAGE_INLINE;
+			data = copy;
+		}
+	} else if ((msg->sz & MESSAGE_SHARED) && !ctx->cb_inline) {
+		//回调函数可能保留消息内容并用skynet_free释放（例如转发模式的服务），交给它一份私有的拷贝
+		char * copy = skynet_slab_alloc(sz+1);
+		memcpy(copy, data, sz);
+		copy[sz] = '\0';
+		skynet_shared_release(data);
+		msg->data = copy;
+		msg->sz &= ~MESSAGE_SHARED;
+		data = copy;
+	}
 	if (ctx->logfile) {			//如果打开了日志文件，则将消息输出到日志文件
-		skynet_log_output(ctx->logfile, msg->source, type, msg->session, msg->data, sz);
+		skynet_log_output(ctx->logfile, msg->source, type, msg->session, data, sz);
 	}
 	++ctx->message_count;	//记录处理消息的数量
 	int reserve_msg;
 	if (ctx->profile) {		//记录消耗CPU时间
+		if (msg->stamp) {	//记录消息在服务队列中等待的时长
+			histogram_record(&ctx->wait, (uint32_t)skynet_monotonic_time() - msg->stamp);
+		}
 		ctx->cpu_start = skynet_thread_time();
-		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);		//调用服务回调进行消息处理
+		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, data, sz);		//调用服务回调进行消息处理
 		uint64_t cost_time = skynet_thread_time() - ctx->cpu_start;
 		ctx->cpu_cost += cost_time;
+		histogram_record(&ctx->exec, cost_time > UINT32_MAX ? UINT32_MAX : (uint32_t)cost_time);
 	} else {
-		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);		//调用服务回调进行消息处理
+		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, data, sz);		//调用服务回调进行消息处理
 	}
 	if (!reserve_msg) {
-		skynet_free(msg->data);
+		message_free(msg);
 	}
 	CHECKCALLING_END(ctx)
 }
@@ -310,6 +400,25 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+//计算本次处理服务队列中消息的数量
+//开启timeslice时，根据服务处理每条消息的平均耗时计算出在目标时长内能处理的消息数量，否则根据weight来决定
+static int
+slice_length(struct skynet_context *ctx, struct message_queue *q, int weight) {
+	int n = 1;
+	if (G_NODE.timeslice > 0 && ctx->profile && ctx->message_count > 0) {
+		n = skynet_mq_length(q);
+		if (ctx->cpu_cost > 0) {
+			uint64_t fit = (uint64_t)G_NODE.timeslice * ctx->message_count / ctx->cpu_cost;
+			if (fit < (uint64_t)n) {
+				n = (int)fit;
+			}
+		}
+	} else if (weight >= 0) {
+		n = skynet_mq_length(q) >> weight;
+	}
+	return n < 1 ? 1 : n;
+}
+
 //消息分发
 struct message_queue * 
 skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
@@ -329,31 +438,33 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 		return skynet_globalmq_pop();	//返回全局队列中的下一个服务队列
 	}
 
-	int i,n=1;
-	struct skynet_message msg;
+	int n = slice_length(ctx, q, weight);	//线程本次处理服务队列中消息的数量
+	struct skynet_message msgs[MESSAGE_BATCH];
 
-	for (i=0;i<n;i++) {
-		if (skynet_mq_pop(q,&msg)) {	//从服务队列中取出消息
+	while (n > 0) {
+		int i, batch = skynet_mq_pop_batch(q, msgs, n < MESSAGE_BATCH ? n : MESSAGE_BATCH);	//一次从服务队列中取出一批消息
+		if (batch == 0) {
 			skynet_context_release(ctx);	//递减服务信息的引用计数，如果计数为0则释放
 			return skynet_globalmq_pop();	//本服务队列暂无消息，不会返回全局队列，返回下一个服务队列
-		} else if (i==0 && weight >= 0) {
-			n = skynet_mq_length(q);	//获得消息的数量
-			n >>= weight;				//根据weight来决定线程本次处理服务队列中消息的数量
 		}
+		n -= batch;
 		int overload = skynet_mq_overload(q);	//获得消息数量超出阈值时的消息数量，并清零记录值
 		if (overload) {
 			skynet_error(ctx, "May overload, message queue length = %d", overload);		//将错误信息输出到logger服务
 		}
 
-		skynet_monitor_trigger(sm, msg.source , handle);	//记录消息源、目的地、version增1，用于监测线程监测该线程是否卡死与某条消息的处理
+		for (i=0;i<batch;i++) {
+			struct skynet_message *msg = &msgs[i];
+			skynet_monitor_trigger(sm, msg->source , handle);	//记录消息源、目的地、version增1，用于监测线程监测该线程是否卡死与某条消息的处理
 
-		if (ctx->cb == NULL) {		//如果服务没有注册回调函数则释放掉消息内容
-			skynet_free(msg.data);
-		} else {
-			dispatch_message(ctx, &msg);	//有回调函数调用相应的回调函数进行处理
-		}
+			if (ctx->cb == NULL) {		//如果服务没有注册回调函数则释放掉消息内容
+				message_free(msg);
+			} else {
+				dispatch_message(ctx, msg);	//有回调函数调用相应的回调函数进行处理
+			}
 
-		skynet_monitor_trigger(sm, 0,0);		//清除记录的消息源、目的地
+			skynet_monitor_trigger(sm, 0,0);		//清除记录的消息源、目的地
+		}
 	}
 
 	assert(q == ctx->queue);
@@ -422,11 +533,39 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	char * session_ptr = NULL;
 	int ti = strtol(param, &session_ptr, 10);
 	int session = skynet_context_newsession(context);	//产生一个唯一的session
-	skynet_timeout(context->handle, ti, session);
+	int64_t ms = (int64_t)ti * 10;
+	if (*session_ptr == '.') {	//带小数的1/100秒，按毫秒计时
+		double t = strtod(param, NULL);
+		if (!(t > 0)) {		// NaN or negative, timeout at once
+			t = 0;
+		} else if (t > INT32_MAX) {	//更长的定时在时间轮中也会被限制为INT32_MAX个tick
+			t = INT32_MAX;
+		}
+		ms = (int64_t)(t * 10 + 0.5);
+	}
+	skynet_timeout_ms(context->handle, ms, session, context->timer_coalesce);
 	sprintf(context->result, "%d", session);
 	return context->result;
 }
 
+//取消TIMEOUT返回的session对应的定时，成功返回"1"，已经触发（消息已在队列中）返回NULL
+static const char *
+cmd_cancel(struct skynet_context * context, const char * param) {
+	int session = strtol(param, NULL, 10);
+	if (skynet_timeout_cancel(context->handle, session)) {
+		strcpy(context->result, "1");
+		return context->result;
+	}
+	return NULL;
+}
+
+//param为"1"时，同一次触发的定时合并为一条PTYPE_TIMER消息投递，"0"关闭
+static const char *
+cmd_timercoalesce(struct skynet_context * context, const char * param) {
+	context->timer_coalesce = (param && strcmp(param, "1") == 0);
+	return NULL;
+}
+
 //param为NULL返回":0x服务编号"，否则为服务命名
 static const char *
 cmd_reg(struct skynet_context * context, const char * param) {
@@ -596,6 +735,9 @@ cmd_monitor(struct skynet_context * context, const char * param) {
 //param为"cpu"，获得该服务消耗CPU时间，整数部分为秒，小数部分精确到微秒
 //param为"time"，获得距离该服务最近一条消息处理开始的时间间隔
 //param为"message"，该服务已经处理消息的数量
+//param为"schedule"，该服务被工作线程取出的次数，param为"migrate"，其中换到其他工作线程的次数（steal模式）
+//param为"wait_p50"、"wait_p99"、"wait_max"等，获得消息在服务队列中等待时长的百分位数，单位为秒
+//param为"exec_p50"、"exec_p99"、"exec_max"等，获得服务处理消息消耗CPU时间的百分位数，单位为秒
 static const char *
 cmd_stat(struct skynet_context * context, const char * param) {
 	if (strcmp(param, "mqlen") == 0) {		//如果param为"mqlen"
@@ -621,12 +763,46 @@ cmd_stat(struct skynet_context * context, const char * param) {
 		}
 	} else if (strcmp(param, "message") == 0) {	//如果param为"message"
 		sprintf(context->result, "%d", context->message_count);		//该服务已经处理消息的数量
+	} else if (strcmp(param, "schedule") == 0 || strcmp(param, "migrate") == 0) {	//被调度的次数，及换到其他工作线程的次数
+		int schedule, migrate;
+		skynet_mq_schedule(context->queue, &schedule, &migrate);
+		sprintf(context->result, "%d", param[0] == 's' ? schedule : migrate);
+	} else if (strncmp(param, "wait_", 5) == 0 || strncmp(param, "exec_", 5) == 0) {
+		struct histogram *h = param[0] == 'w' ? &context->wait : &context->exec;
+		const char * what = param + 5;
+		uint32_t v = 0;
+		if (strcmp(what, "max") == 0) {
+			v = h->max;
+		} else if (what[0] == 'p') {
+			v = histogram_percentile(h, strtod(what + 1, NULL));
+		}
+		sprintf(context->result, "%lf", (double)v / 1000000.0);
 	} else {
 		context->result[0] = '\0';
 	}
 	return context->result;
 }
 
+//设置服务的调度优先级，param为"high"或"normal"，为空时只获取，返回当前的优先级
+//在服务初始化函数中设置，服务第一次进入全局队列时即生效
+static const char *
+cmd_priority(struct skynet_context * context, const char * param) {
+	int priority = -1;
+	if (param && param[0]) {
+		if (strcmp(param, "high") == 0) {
+			priority = MQ_PRIORITY_HIGH;
+		} else if (strcmp(param, "normal") == 0) {
+			priority = MQ_PRIORITY_NORMAL;
+		} else {
+			skynet_error(context, "Invalid priority %s", param);
+			return NULL;
+		}
+	}
+	priority = skynet_mq_priority(context->queue, priority);
+	strcpy(context->result, priority == MQ_PRIORITY_HIGH ? "high" : "normal");
+	return context->result;
+}
+
 //为指定服务打开一个log文件，该文件的名字为：指定服务编号的十六进制形式.log
 //param可以是":+十六进制的服务编号"或者是".+服务名"形式
 static const char *
@@ -697,6 +873,8 @@ cmd_signal(struct skynet_context * context, const char * param) {
 
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "CANCEL", cmd_cancel },
+	{ "TIMERCOALESCE", cmd_timercoalesce },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
@@ -712,6 +890,7 @@ static struct command_func cmd_funcs[] = {
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
+	{ "PRIORITY", cmd_priority },
 	{ NULL, NULL },
 };
 
@@ -732,7 +911,8 @@ skynet_command(struct skynet_context * context, const char * cmd , const char *
 //消息发送前的参数处理
 static void
 _filter_args(struct skynet_context * context, int type, int *session, void ** data, size_t * sz) {
-	int needcopy = !(type & PTYPE_TAG_DONTCOPY);		//判断是否需要拷贝消息内容
+	int needcopy = !(type & (PTYPE_TAG_DONTCOPY | PTYPE_TAG_SHARED));		//判断是否需要拷贝消息内容
+	int shared = (type & PTYPE_TAG_SHARED) && *data;	//共享的消息内容只增加引用计数
 	int allocsession = type & PTYPE_TAG_ALLOCSESSION;	//是否需要分配session
 	type &= 0xff;		//获得消息的类型（256种）
 
@@ -742,13 +922,19 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 	}
 
 	if (needcopy && *data) {		//拷贝发现消息的内容
-		char * msg = skynet_malloc(*sz+1);
+		char * msg = skynet_slab_alloc(*sz+1);
 		memcpy(msg, *data, *sz);
 		msg[*sz] = '\0';
 		*data = msg;
 	}
+	if (shared) {
+		skynet_shared_retain(*data);
+	}
 
 	*sz |= (size_t)type << MESSAGE_TYPE_SHIFT;		//将消息类型添加到消息大小的高8位
+	if (shared) {
+		*sz |= MESSAGE_SHARED;
+	}
 }
 
 /****************************
@@ -772,6 +958,13 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		}
 		return -1;
 	}
+	int inline_msg = 0;
+	if (destination == 0 || skynet_harbor_message_isremote(destination)) {
+		type &= ~PTYPE_TAG_SHARED;	//跨节点的消息由harbor服务释放，按普通消息拷贝
+	} else if (!(type & (PTYPE_TAG_DONTCOPY | PTYPE_TAG_SHARED)) && data && sz < MESSAGE_INLINE_SIZE) {
+		inline_msg = 1;		//很小的消息内容直接拷贝到消息中，不需要分配内存
+		type |= PTYPE_TAG_DONTCOPY;
+	}
 	_filter_args(context, type, &session, (void **)&data, &sz);		//消息发送前的参数处理
 
 	if (source == 0) {
@@ -791,17 +984,82 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		struct skynet_message smsg;
 		smsg.source = source;
 		smsg.session = session;
-		smsg.data = data;
+		if (inline_msg) {
+			size_t len = sz & MESSAGE_TYPE_MASK;
+			memcpy(smsg.inline_data, data, len);
+			smsg.inline_data[len] = '\0';
+			sz |= MESSAGE_INLINE;
+		} else {
+			smsg.data = data;
+		}
 		smsg.sz = sz;
 
 		if (skynet_context_push(destination, &smsg)) {		//将消息添加到handle对于的服务信息中的服务队列中
-			skynet_free(data);
+			message_free(&smsg);
 			return -1;
 		}
 	}
 	return session;
 }
 
+//向n个服务发送同一条不需要回应的消息，本地的服务共享一份引用计数的消息内容，返回成功发送的数量
+int
+skynet_sendmulti(struct skynet_context * context, uint32_t source, const uint32_t * destination, int n, int type, void * data, size_t sz) {
+	if ((sz & MESSAGE_TYPE_MASK) != sz) {	//消息太大
+		skynet_error(context, "The multicast message is too large");
+		if (type & PTYPE_TAG_DONTCOPY) {
+			skynet_free(data);
+		}
+		return -1;
+	}
+	if (source == 0) {
+		source = context->handle;
+	}
+	void * shared = data;
+	if (type & PTYPE_TAG_SHARED) {
+		skynet_shared_retain(shared);	//调用者仍然持有自己的引用
+	} else {
+		shared = skynet_shared_new(data, sz);	//只拷贝一次
+		if (type & PTYPE_TAG_DONTCOPY) {
+			skynet_free(data);
+		}
+	}
+	type &= 0xff;
+	struct shared_buffer * sb = (struct shared_buffer *)shared - 1;
+	ATOM_ADD(&sb->ref, n);	// one for each destination, and one for myself
+	int i;
+	int count = 0;
+	int drop = 0;
+	for (i=0;i<n;i++) {
+		uint32_t des = destination[i];
+		if (des == 0) {
+			++drop;
+			continue;
+		}
+		if (skynet_harbor_message_isremote(des)) {	//跨节点的消息需要单独的拷贝
+			++drop;
+			if (skynet_send(context, source, des, type, 0, shared, sz) >= 0) {
+				++count;
+			}
+			continue;
+		}
+		struct skynet_message smsg;
+		smsg.source = source;
+		smsg.session = 0;
+		smsg.data = shared;
+		smsg.sz = sz | (size_t)type << MESSAGE_TYPE_SHIFT | MESSAGE_SHARED;
+		if (skynet_context_push(des, &smsg)) {
+			++drop;
+		} else {
+			++count;
+		}
+	}
+	if (ATOM_SUB(&sb->ref, drop + 1) == 0) {
+		skynet_free(sb);
+	}
+	return count;
+}
+
 //通过addr指定的服务发送消息，addr的形式可以为".+服务名"或者":0x服务编号"
 //返回session
 int
@@ -821,7 +1079,7 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 			return -1;
 		}
 	} else {
-		_filter_args(context, type, &session, (void **)&data, &sz);
+		_filter_args(context, type & ~PTYPE_TAG_SHARED, &session, (void **)&data, &sz);	//跨节点的消息需要普通的拷贝
 
 		struct remote_message * rmsg = skynet_malloc(sizeof(*rmsg));
 		copy_name(rmsg->destination.name, addr);
@@ -849,6 +1107,12 @@ skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb) {
 	context->cb_ud = ud;
 }
 
+//设置回调函数是否可以直接接收内嵌在消息中的内容
+void
+skynet_callback_inline(struct skynet_context * context, int enable) {
+	context->cb_inline = enable ? true : false;
+}
+
 /****************************
 函数功能：用于跨节点发送消息
 参数：
@@ -866,6 +1130,7 @@ skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t
 	smsg.session = session;
 	smsg.data = msg;
 	smsg.sz = sz | (size_t)type << MESSAGE_TYPE_SHIFT;
+	smsg.stamp = ctx->profile ? (uint32_t)skynet_monotonic_time() : 0;
 
 	skynet_mq_push(ctx->queue, &smsg);		//将消息添加到服务队列
 }
@@ -902,3 +1167,9 @@ void
 skynet_profile_enable(int enable) {
 	G_NODE.profile = (bool)enable;
 }
+
+//设置每次处理服务队列消息的目标时长，需要开启profile才能测量服务处理消息的耗时
+void
+skynet_timeslice_enable(int microsec) {
+	G_NODE.timeslice = microsec;
+}
@@ -27,5 +27,6 @@ void skynet_globalexit(void);
 void skynet_initthread(int m);
 
 void skynet_profile_enable(int enable);
+void skynet_timeslice_enable(int microsec);	// 0 : use the static weight of each worker
 
 #endif
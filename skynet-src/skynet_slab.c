@@ -0,0 +1,140 @@
+#include "skynet.h"
+
+#include "skynet_slab.h"
+#include "skynet_pool.h"
+#include "atomic.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SLAB_MINSHIFT 4				//最小的对象为16字节
+#define SLAB_CLASS 9				//16,32,...,4096
+#define SLAB_PAGESHIFT 16
+#define SLAB_PAGESIZE (1 << SLAB_PAGESHIFT)		//每页64K，同一页只存放同样大小的对象
+
+struct slab_class {
+	struct skynet_pool *pool;		//该大小的对象池
+	char *page;						//当前页中尚未分配的内存
+	size_t left;					//当前页剩余的字节数
+};
+
+struct slab {
+	char *base;						//预留的地址空间的起始地址，为NULL表示没有开启
+	char *end;						//预留的地址空间的结束地址
+	size_t used;					//已经分出去的字节数，按页对齐
+	uint8_t *page_class;			//每一页存放的对象大小的序号
+	struct slab_class c[SLAB_CLASS];
+};
+
+static struct slab S;
+
+//sz字节的对象对应的大小序号
+static inline int
+slab_class(size_t sz) {
+	if (sz <= (1 << SLAB_MINSHIFT)) {
+		return 0;
+	}
+	return (int)(sizeof(unsigned long) * 8 - __builtin_clzl((unsigned long)(sz - 1))) - SLAB_MINSHIFT;
+}
+
+#ifndef NOUSE_JEMALLOC
+
+//对象池需要一批新的对象时调用，已经在对象池的锁中
+static void *
+slab_chunk(void *ud, size_t sz) {
+	struct slab_class *c = ud;
+	if (c->left < sz) {
+		size_t n = (sz + SLAB_PAGESIZE - 1) & ~(size_t)(SLAB_PAGESIZE - 1);
+		size_t offset = ATOM_ADD(&S.used, n) - n;
+		if (offset + n > (size_t)(S.end - S.base)) {	//地址空间用完了
+			return NULL;
+		}
+		uint8_t class = (uint8_t)(c - S.c);
+		memset(S.page_class + (offset >> SLAB_PAGESHIFT), class, n >> SLAB_PAGESHIFT);
+		c->page = S.base + offset;
+		c->left = n;
+	}
+	void * ret = c->page;
+	c->page += sz;
+	c->left -= sz;
+	return ret;
+}
+
+//预留mb兆字节的地址空间，实际使用时才占用物理内存
+void
+skynet_slab_init(int mb) {
+	if (mb <= 0) {
+		return;
+	}
+	size_t sz = (size_t)mb << 20;
+	char * base = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "slab: reserve %d MB failed, use malloc for messages\n", mb);
+		return;
+	}
+	S.page_class = skynet_malloc(sz >> SLAB_PAGESHIFT);
+	int i;
+	for (i=0;i<SLAB_CLASS;i++) {
+		S.c[i].pool = skynet_pool_newchunk((size_t)1 << (i + SLAB_MINSHIFT), slab_chunk, &S.c[i]);
+		S.c[i].page = NULL;
+		S.c[i].left = 0;
+	}
+	S.used = 0;
+	S.end = base + sz;
+	ATOM_SYNC();
+	S.base = base;
+}
+
+#else
+
+void
+skynet_slab_init(int mb) {
+	// skynet_free is the libc free here, it can't recognize the objects of slab
+	(void)mb;
+}
+
+#endif
+
+void *
+skynet_slab_alloc(size_t sz) {
+	if (S.base && sz <= SKYNET_SLAB_MAXSIZE) {
+		void * ptr = skynet_pool_alloc(S.c[slab_class(sz)].pool);
+		if (ptr) {
+			return ptr;
+		}
+	}
+	return skynet_malloc(sz);
+}
+
+size_t
+skynet_slab_size(void *ptr) {
+	char * p = ptr;
+	if (p < S.base || p >= S.end) {
+		return 0;
+	}
+	return (size_t)1 << (S.page_class[(p - S.base) >> SLAB_PAGESHIFT] + SLAB_MINSHIFT);
+}
+
+int
+skynet_slab_free(void *ptr) {
+	char * p = ptr;
+	if (p < S.base || p >= S.end) {
+		return 0;
+	}
+	skynet_pool_free(S.c[S.page_class[(p - S.base) >> SLAB_PAGESHIFT]].pool, ptr);
+	return 1;
+}
+
+int
+skynet_slab_stat(struct skynet_pool_stat *st, int n) {
+	if (S.base == NULL) {
+		return 0;
+	}
+	int i;
+	for (i=0;i<n && i<SLAB_CLASS;i++) {
+		skynet_pool_stat(S.c[i].pool, &st[i]);
+	}
+	return i;
+}
@@ -0,0 +1,24 @@
+#ifndef SKYNET_SLAB_H
+#define SKYNET_SLAB_H
+
+#include <stddef.h>
+
+#include "skynet_pool.h"
+
+// Size classed allocator for small message payloads (16 to 4096 bytes).
+// Objects are carved from one reserved address range, so skynet_free can tell them apart
+// and return them to the slab; a payload can be freed by any thread, like a skynet_malloc one.
+// It needs the malloc hook, without jemalloc (NOUSE_JEMALLOC) skynet_slab_alloc is skynet_malloc.
+
+#define SKYNET_SLAB_MAXSIZE 4096
+
+void skynet_slab_init(int mb);
+void * skynet_slab_alloc(size_t sz);
+// returns the object size if ptr belongs to the slab, otherwise 0
+size_t skynet_slab_size(void *ptr);
+// returns 0 if ptr doesn't belong to the slab
+int skynet_slab_free(void *ptr);
+// fills the stat of each size class, returns the number of classes
+int skynet_slab_stat(struct skynet_pool_stat *st, int n);
+
+#endif
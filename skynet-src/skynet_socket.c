@@ -13,13 +13,13 @@
 
 static struct socket_server * SOCKET_SERVER = NULL;			//全局的套接字服务信息
 
-//初始化全局的套接字服务信息
+//初始化全局的套接字服务信息，thread为网络线程的数量，uring为真时使用io_uring
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create();
+skynet_socket_init(int thread, int uring) {
+	SOCKET_SERVER = socket_server_create_thread(thread, uring);
 }
 
-//向套接字服务器发送退出命令, 这将导致主循环函数 skynet_socket_poll 返回 0 , 从而令 socket 线程退出,
+//向套接字服务器发送退出命令, 这将导致主循环函数 skynet_socket_poll 返回 0 , 从而令所有 socket 线程退出,
 //整个过程是一个异步的过程. 需要注意的是, 退出函数并没有销毁套接字服务器的内存. 
 void
 skynet_socket_exit() {
@@ -74,14 +74,14 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	}
 }
 
-//处理所有套接字上的事件，返回处理的结果，将处理的结果及结果信息转发给对应的服务
+//处理第thread个网络线程负责的套接字上的事件，返回处理的结果，将处理的结果及结果信息转发给对应的服务
 int 
-skynet_socket_poll() {
+skynet_socket_poll(int thread) {
 	struct socket_server *ss = SOCKET_SERVER;
 	assert(ss);
 	struct socket_message result;
 	int more = 1;
-	int type = socket_server_poll(ss, &result, &more);	//处理所有套接字上的事件，返回处理结果及信息
+	int type = socket_server_poll_thread(ss, thread, &result, &more);	//处理所有套接字上的事件，返回处理结果及信息
 	switch (type) {
 	case SOCKET_EXIT:
 		return 0;			//整个套接字服务退出
@@ -106,6 +106,9 @@ skynet_socket_poll() {
 	case SOCKET_WARNING:	//写缓存超出阈值
 		forward_message(SKYNET_SOCKET_TYPE_WARNING, false, &result);
 		break;
+	case SOCKET_UDPBATCH:	//接收到多个UDP数据包
+		forward_message(SKYNET_SOCKET_TYPE_UDPBATCH, false, &result);
+		break;
 	default:
 		skynet_error(NULL, "Unknown socket message type %d.",type);
 		return -1;
@@ -220,3 +223,9 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	sm.data = msg->buffer;
 	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
 }
+
+//设置UDP套接字是否批量接收数据，开启后会收到 SKYNET_SOCKET_TYPE_UDPBATCH 消息
+void
+skynet_socket_udp_batch(struct skynet_context *ctx, int id, int enable) {
+	socket_server_udp_batch(SOCKET_SERVER, id, enable);
+}
@@ -11,6 +11,7 @@ struct skynet_context;
 #define SKYNET_SOCKET_TYPE_ERROR 5		//出错返回
 #define SKYNET_SOCKET_TYPE_UDP 6		//接收到UDP数据
 #define SKYNET_SOCKET_TYPE_WARNING 7	//写缓存超出阈值
+#define SKYNET_SOCKET_TYPE_UDPBATCH 8	//接收到的多个UDP数据包，格式见socket_server_udp_batch
 
 struct skynet_socket_message {	//发送到 skynet 各个服务去的套接字消息
 	int type;		//套接字消息的类型，取上面的预定义值
@@ -19,10 +20,10 @@ struct skynet_socket_message {	//发送到 skynet 各个服务去的套接字消
 	char * buffer;	//套接字消息的数据
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int thread, int uring);
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int thread);
 
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);
 int skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);
@@ -38,5 +39,6 @@ int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
 int skynet_socket_udp_send(struct skynet_context *ctx, int id, const char * address, const void *buffer, int sz);
 const char * skynet_socket_udp_address(struct skynet_socket_message *, int *addrsz);
+void skynet_socket_udp_batch(struct skynet_context *ctx, int id, int enable);
 
 #endif
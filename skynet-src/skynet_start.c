@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _GNU_SOURCE		// for pthread_setaffinity_np
+#endif
+
 #include "skynet.h"
 #include "skynet_server.h"
 #include "skynet_imp.h"
@@ -9,6 +13,8 @@
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
 #include "skynet_harbor.h"
+#include "skynet_slab.h"
+#include "malloc_hook.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -17,14 +23,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <ctype.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <dirent.h>
+#endif
 
 struct monitor {				//用做定时器、监测、套接字和工作线程的运行函数都共享的参数
 	int count;					//工作线程数量，即配置中配的
 	struct skynet_monitor ** m;	//为每个工作线程存储监测信息的结构体
-	pthread_cond_t cond;		//多线程同步机制中的条件变量
-	pthread_mutex_t mutex;		//多线程同步机制中的互斥锁
-	int sleep;					//记录处于阻塞状态的线程数量
 	int quit;					//标记线程是否退出
+	const char * socket_cpu;	//套接字线程绑定的CPU集合，多个集合用';'分隔，第i个套接字线程使用第i%n个集合
+	const char * timer_cpu;		//定时器线程绑定的CPU集合
+	const char * worker_cpu;	//工作线程绑定的CPU集合，多个集合用';'分隔，第i个工作线程使用第i%n个集合
+	int numa;					//线程是否使用所在NUMA节点专用的jemalloc arena
 };
 
 struct worker_parm {			//用做工作线程的运行函数的参数
@@ -33,6 +46,11 @@ struct worker_parm {			//用做工作线程的运行函数的参数
 	int weight;					//标记每个线程每次处理服务队列中的消息数量
 };
 
+struct socket_parm {			//用做套接字线程的运行函数的参数
+	struct monitor *m;
+	int id;						//每个套接字线程的序号，只处理属于自己的套接字
+};
+
 static int SIG = 0;
 
 static void
@@ -54,29 +72,122 @@ create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg) {
 	}
 }
 
-//唤醒等待条件触发的线程
+#if defined(__linux__)
+
+//获得cpu所在的NUMA节点，没有NUMA信息返回0
+static int
+cpu_node(int cpu) {
+	char path[64];
+	sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return 0;
+	}
+	int node = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (strncmp(ent->d_name, "node", 4) == 0 && isdigit((unsigned char)ent->d_name[4])) {
+			node = strtol(ent->d_name + 4, NULL, 10);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+//将当前线程绑定到cpus指定的CPU集合，cpus的形式如"0-3,8"，返回集合中的第一个CPU，失败返回-1
+static int
+bind_cpu(const char *cpus, int len) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int first = -1;
+	const char *p = cpus;
+	const char *end = cpus + len;
+	while (p < end) {
+		char *next;
+		int from = strtol(p, &next, 10);
+		if (next == p) {
+			break;
+		}
+		int to = from;
+		if (*next == '-') {
+			p = next + 1;
+			to = strtol(p, &next, 10);
+			if (next == p) {
+				break;
+			}
+		}
+		int i;
+		for (i=from;i<=to && i<CPU_SETSIZE;i++) {
+			CPU_SET(i, &set);
+		}
+		if (first < 0 || from < first) {
+			first = from;
+		}
+		p = next;
+		while (p < end && (*p == ',' || *p == ' ')) {
+			++p;
+		}
+	}
+	if (p < end || first < 0) {
+		fprintf(stderr, "Invalid cpu set : %.*s\n", len, cpus);
+		return -1;
+	}
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+		fprintf(stderr, "Bind thread to cpu set %.*s failed\n", len, cpus);
+		return -1;
+	}
+	return first;
+}
+
+#endif
+
+//按配置将当前线程绑定到CPU集合列表cpus（用';'分隔）中的第index个集合，开启numa时同时使用该节点的arena
 static void
-wakeup(struct monitor *m, int busy) {
-	if (m->sleep >= m->count - busy) {
-		// signal sleep worker, "spurious wakeup" is harmless
-		pthread_cond_signal(&m->cond);	//激活一个等待该条件的线程，存在多个等待线程时按入队顺序激活其中一个；
+thread_affinity(struct monitor *m, const char *cpus, int index) {
+	if (cpus == NULL) {
+		return;
+	}
+#if defined(__linux__)
+	int n = 1;
+	const char *p;
+	for (p=cpus;*p;p++) {
+		if (*p == ';') {
+			++n;
+		}
+	}
+	index %= n;
+	const char *set = cpus;
+	while (index-- > 0) {
+		set = strchr(set, ';') + 1;
 	}
+	const char *end = strchr(set, ';');
+	int cpu = bind_cpu(set, end ? (int)(end - set) : (int)strlen(set));
+	if (cpu >= 0 && m->numa) {
+		malloc_thread_arena(cpu_node(cpu));
+	}
+#else
+	fprintf(stderr, "Thread affinity is not supported on this platform\n");
+#endif
 }
 
 //套接字线程运行函数
+//转发给服务的消息会在服务队列进入全局队列时直接唤醒睡眠的工作线程
 static void *
 thread_socket(void *p) {
-	struct monitor * m = p;
+	struct socket_parm *sp = p;
+	struct monitor * m = sp->m;
+	int id = sp->id;
 	skynet_initthread(THREAD_SOCKET);	//初始化该线程对应的私有数据块
+	thread_affinity(m, m->socket_cpu, id);
 	for (;;) {
-		int r = skynet_socket_poll();	//处理所有套接字上的事件，返回处理的结果，将处理的结果及结果信息转发给对应的服务
+		int r = skynet_socket_poll(id);	//处理该线程负责的套接字上的事件，返回处理的结果，将处理的结果及结果信息转发给对应的服务
 		if (r==0)						//线程退出
 			break;
 		if (r<0) {
 			CHECK_ABORT		//检测总的服务数量，为0则break
 			continue;
 		}
-		wakeup(m,0);		//如果所有工作线程都处于等待状态，则唤醒其中一个
 	}
 	return NULL;
 }
@@ -89,8 +200,6 @@ free_monitor(struct monitor *m) {
 	for (i=0;i<n;i++) {
 		skynet_monitor_delete(m->m[i]);
 	}
-	pthread_mutex_destroy(&m->mutex);
-	pthread_cond_destroy(&m->cond);
 	skynet_free(m->m);
 	skynet_free(m);
 }
@@ -137,11 +246,11 @@ static void *
 thread_timer(void *p) {
 	struct monitor * m = p;
 	skynet_initthread(THREAD_TIMER);	//初始化该线程对应的私有数据块
+	thread_affinity(m, m->timer_cpu, 0);
 	for (;;) {
 		skynet_updatetime();			//刷新时间
 		CHECK_ABORT						//检测总的服务数量，为0则break
-		wakeup(m,m->count-1);			//唤醒等待条件触发的线程
-		usleep(2500);					//定时器线程挂起2500微秒
+		skynet_timer_wait();			//定时器线程挂起到下一个可能有事件的时间片
 		if (SIG) {						//如果触发终端关闭的信号SIGHUP，则打开log文件
 			signal_hup();				//发送服务内部消息打开log文件，将log输出到文件
 			SIG = 0;
@@ -150,10 +259,8 @@ thread_timer(void *p) {
 	// wakeup socket thread
 	skynet_socket_exit();				//正常结束套接字服务
 	// wakeup all worker thread
-	pthread_mutex_lock(&m->mutex);		//获得互斥锁
 	m->quit = 1;						//设置线程退出标志
-	pthread_cond_broadcast(&m->cond);	//激活所有等待条件触发的线程
-	pthread_mutex_unlock(&m->mutex);	//释放互斥锁
+	skynet_globalmq_exit();				//唤醒所有睡眠的工作线程
 	return NULL;
 }
 
@@ -166,53 +273,48 @@ thread_worker(void *p) {
 	struct monitor *m = wp->m;
 	struct skynet_monitor *sm = m->m[id];
 	skynet_initthread(THREAD_WORKER);		//初始化该线程对应的私有数据块
+	skynet_globalmq_worker(id);				//绑定该工作线程的本地队列
+	thread_affinity(m, m->worker_cpu, id);	//绑定该工作线程的CPU集合
 	struct message_queue * q = NULL;
 	while (!m->quit) {
 		q = skynet_context_message_dispatch(sm, q, weight);		//消息分发
-		if (q == NULL) {	//如果全局队列中没有服务队列信息，尝试获得互斥锁，等待定时器线程或套接字线程触发条件
-			if (pthread_mutex_lock(&m->mutex) == 0) {	//获得互斥锁，如该锁已被其他工作线程锁住或拥有，则该线程阻塞直到可以
-				++ m->sleep;		//线程阻塞计数加1
-				// "spurious wakeup" is harmless,
-				// because skynet_context_message_dispatch() can be call at any time.
-				if (!m->quit)
-					pthread_cond_wait(&m->cond, &m->mutex);		//等待条件触发
-				-- m->sleep;	//线程阻塞计数减1
-				if (pthread_mutex_unlock(&m->mutex)) {		//释放互斥锁
-					fprintf(stderr, "unlock mutex error");
-					exit(1);
-				}
-			}
+		if (q == NULL && !m->quit) {	//如果全局队列中没有服务队列信息，自旋后睡眠，服务队列进入全局队列时会被唤醒
+			// "spurious wakeup" is harmless,
+			// because skynet_context_message_dispatch() can be call at any time.
+			skynet_globalmq_park();
 		}
 	}
 	return NULL;
 }
 
 static void
-start(int thread) {
-	pthread_t pid[thread+3];
+start(struct skynet_config * config) {
+	int thread = config->thread;
+	int socket_thread = config->socket_thread;
+	pthread_t pid[thread+2+socket_thread];
 
 	struct monitor *m = skynet_malloc(sizeof(*m));		//后面创建的线程都共享参数
 	memset(m, 0, sizeof(*m));
 	m->count = thread;		//工作线程的数量
-	m->sleep = 0;			//记录处于阻塞状态的线程数量
+	m->socket_cpu = config->socket_cpu;
+	m->timer_cpu = config->timer_cpu;
+	m->worker_cpu = config->worker_cpu;
+	m->numa = config->numa;
 
 	m->m = skynet_malloc(thread * sizeof(struct skynet_monitor *)); //为每个工作线程第一个存储监测信息的结构体
 	int i;
 	for (i=0;i<thread;i++) {
 		m->m[i] = skynet_monitor_new();		//为每一个工作线程分配一块监测信息的内存
 	}
-	if (pthread_mutex_init(&m->mutex, NULL)) {	//初始化互斥锁
-		fprintf(stderr, "Init mutex error");
-		exit(1);
-	}
-	if (pthread_cond_init(&m->cond, NULL)) {	//初始化条件变量
-		fprintf(stderr, "Init cond error");
-		exit(1);
-	}
 
 	create_thread(&pid[0], thread_monitor, m);		//创建监测线程
 	create_thread(&pid[1], thread_timer, m);		//创建定时器线程
-	create_thread(&pid[2], thread_socket, m);		//创建套接字线程
+	struct socket_parm sp[socket_thread];
+	for (i=0;i<socket_thread;i++) {
+		sp[i].m = m;
+		sp[i].id = i;
+		create_thread(&pid[i+2], thread_socket, &sp[i]);	//创建套接字线程
+	}
 
 	static int weight[] = { 						//-1表示每个线程每次处理服务队列中的消息数量为1
 		-1, -1, -1, -1, 0, 0, 0, 0,					//0表示每个线程每次处理服务队列中的所有消息
@@ -228,10 +330,10 @@ start(int thread) {
 		} else {
 			wp[i].weight = 0;
 		}
-		create_thread(&pid[i+3], thread_worker, &wp[i]);	//创建工作线程
+		create_thread(&pid[i+2+socket_thread], thread_worker, &wp[i]);	//创建工作线程
 	}
 
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+2+socket_thread;i++) {
 		pthread_join(pid[i], NULL); 	//等待各个线程结束
 	}
 
@@ -270,11 +372,17 @@ skynet_start(struct skynet_config * config) {
 	}
 	skynet_harbor_init(config->harbor);		//初始化节点号
 	skynet_handle_init(config->harbor);		//初始化全局服务信息
-	skynet_mq_init();		//初始化全局队列
+	skynet_mq_init(config->steal ? config->thread : 0, config->affinity);		//初始化全局队列，开启steal时每个工作线程有各自的本地队列
 	skynet_module_init(config->module_path);	//初始化需要加载的动态库的路径
-	skynet_timer_init();	//初始化计时
-	skynet_socket_init();	//创建一个epoll
+	//为小的消息内容预留地址空间，slab的页由所有线程共享并跨线程回收，开启numa时不使用，消息内容由各线程所在节点的arena分配
+	skynet_slab_init(config->numa ? 0 : config->slab);
+	skynet_timer_init(config->timer_tick, config->thread);	//初始化计时，一个时间片为timer_tick毫秒，每个工作线程一个时间轮
+	if (config->socket_thread < 1) {
+		config->socket_thread = 1;
+	}
+	skynet_socket_init(config->socket_thread, config->socket_uring);	//每个套接字线程创建一个epoll
 	skynet_profile_enable(config->profile);		//设置是否开启监测每个服务的CPU耗时标志
+	skynet_timeslice_enable(config->timeslice);	//设置每次处理服务队列消息的目标时长（微秒），0表示使用固定的weight
 
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);	//新建有一个logger服务
 	if (ctx == NULL) {
@@ -284,7 +392,7 @@ skynet_start(struct skynet_config * config) {
 
 	bootstrap(ctx, config->bootstrap);		//新建一个snlua服务
 
-	start(config->thread);		//开始工作，创建定时器、监测、套接字和相应数量的工作线程
+	start(config);		//开始工作，创建定时器、监测、套接字和相应数量的工作线程
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
@@ -4,6 +4,7 @@
 #include "skynet_mq.h"
 #include "skynet_server.h"
 #include "skynet_handle.h"
+#include "skynet_pool.h"
 #include "spinlock.h"
 
 #include <time.h>
@@ -11,6 +12,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
 
 #if defined(__APPLE__)
 #include <sys/time.h>
@@ -27,50 +34,165 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_NEAR_MASK (TIME_NEAR-1)		//0xff
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)		//0x3f
 
+#define DEFAULT_TICK 10		// 10ms, centisecond
+#define MAX_WAIT 100		// the timer thread wakes up at least every 100ms
+#define DEFAULT_HASH_SIZE 256
+
 struct timer_event {
 	uint32_t handle;		//记录定位服务的编号
 	int session;			//记录用于接收消息响应时，定位到是响应哪一条消息，由发送消息的服务生成
+	int coalesce;			//同一次触发中同一个服务的定时合并为一条PTYPE_TIMER消息
+};
+
+struct timer_batch {		//等待合并投递的定时
+	uint32_t handle;
+	int session;
+	int index;				//触发的顺序
 };
 
 struct timer_node {				//节点
 	struct timer_node *next;	//指向下一个节点
+	struct timer_node *prev;	//指向上一个节点，用于O(1)删除
+	struct timer_node *hnext;	//哈希表中的下一个节点，用(handle, session)查找节点
 	uint32_t expire;			//保存该节点的timer_event消息回复事件的触发时间片为：添加时的时间片加上延时触发的时间
 };
 
-struct link_list {				//链表
-	struct timer_node head;		//头节点，head.next指向第一个节点
-	struct timer_node *tail;	//尾节点
+struct link_list {				//双向循环链表
+	struct timer_node head;		//头节点，head.next指向第一个节点，head.prev指向尾节点
 };
 
 struct timer {
 	struct link_list near[TIME_NEAR];	//保存时间片低8位的链表，每次都是从该数组中取链表
 	struct link_list t[4][TIME_LEVEL];	//保存时间片高24位的链表，按照0，1，2，3从低位到高位都分别对应6位
 	struct spinlock lock;				//锁
-	uint32_t time;						//当前的时间片，单位为1/100秒
+	uint32_t time;						//当前的时间片，单位为tick毫秒
+	int hash_size;						//哈希表的大小，2的幂
+	int hash_count;						//在链表中等待的节点数量
+	struct timer_node **hash;			//所有在链表中等待的节点，用于取消
+};
+
+// Timers are sharded by service handle, each shard is a wheel with its own lock.
+// The timer thread advances all the wheels together, so they share the same time.
+struct timer_set {
+	struct timer *wheel;				//按服务handle分片的时间轮
+	int count;							//时间轮的数量
+	struct skynet_pool *pool;			//节点timer_node + timer_event的对象池
+	int batch_cap;						// only the timer thread uses batch
+	struct timer_batch *batch;			//需要合并投递的定时
+	struct spinlock lock;				//保护wake和timerfd
 	uint32_t starttime;					//系统的开始实时时间，从UTC1970-1-1 0:0:0开始计时，精确到秒
-	uint64_t current;					//从开始时刻到现在的时长，精确到1/100秒
-	uint64_t current_point;				//系统启动时长，精确到1/100秒
+	uint64_t current;					//开始时刻小于秒的部分，精确到1/100秒
+	uint64_t current_point;				//系统启动时长，单位为tick毫秒
+	uint64_t origin;					//初始化时的系统启动时长，单位为tick毫秒
+	uint64_t base;						//时间片为0时对应的系统启动时长，单位为tick毫秒
+	int tick;							//一个时间片的毫秒数，能整除10
+	uint32_t wake;						//定时器线程下次醒来的时间片
+	int fd;								// timerfd, -1 if not supported
 };
 
-static struct timer * TI = NULL;
+static struct timer_set * TI = NULL;
+
+static inline void
+link_init(struct link_list *list) {
+	list->head.next = &list->head;
+	list->head.prev = &list->head;
+}
+
+static inline int
+link_empty(struct link_list *list) {
+	return list->head.next == &list->head;
+}
 
-//清除指定链表，并返回指向链表的第一个节点的指针
+//清除指定链表，并返回指向链表的第一个节点的指针，返回的链表以NULL结尾
 static inline struct timer_node *
 link_clear(struct link_list *list) {
+	if (link_empty(list)) {
+		return NULL;
+	}
 	struct timer_node * ret = list->head.next;	//取出指向第一个节点的指针
-	list->head.next = 0;
-	list->tail = &(list->head);
+	list->head.prev->next = NULL;
+	link_init(list);
 
 	return ret;
 }
 
-//向link_list链表中添加timer_node，head->next指向第一个，
-//tail指向尾节点，并且节点timer_node的后面附加有timer_event的信息
+//向link_list链表尾部添加timer_node，并且节点timer_node的后面附加有timer_event的信息
+static inline void
+link_node(struct link_list *list,struct timer_node *node) {
+	struct timer_node *tail = list->head.prev;
+	node->prev = tail;
+	node->next = &list->head;
+	tail->next = node;
+	list->head.prev = node;
+}
+
+//从所在的链表中删除节点
 static inline void
-link(struct link_list *list,struct timer_node *node) {
-	list->tail->next = node;
-	list->tail = node;
-	node->next=0;
+link_remove(struct timer_node *node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline uint32_t
+hash_index(struct timer *T, uint32_t handle, int session) {
+	return (handle * 2654435761u ^ (uint32_t)session) & (T->hash_size - 1);
+}
+
+static void
+hash_insert(struct timer *T, struct timer_node *node) {
+	if (T->hash_count >= T->hash_size) {	//扩容
+		int old_size = T->hash_size;
+		struct timer_node **old = T->hash;
+		T->hash_size *= 2;
+		T->hash = skynet_malloc(T->hash_size * sizeof(struct timer_node *));
+		memset(T->hash, 0, T->hash_size * sizeof(struct timer_node *));
+		int i;
+		for (i=0;i<old_size;i++) {
+			struct timer_node *n = old[i];
+			while (n) {
+				struct timer_node *next = n->hnext;
+				struct timer_event *event = (struct timer_event *)(n+1);
+				struct timer_node **slot = &T->hash[hash_index(T, event->handle, event->session)];
+				n->hnext = *slot;
+				*slot = n;
+				n = next;
+			}
+		}
+		skynet_free(old);
+	}
+	struct timer_event *event = (struct timer_event *)(node+1);
+	struct timer_node **slot = &T->hash[hash_index(T, event->handle, event->session)];
+	node->hnext = *slot;
+	*slot = node;
+	++T->hash_count;
+}
+
+//查找(handle, session)对应的节点，没找到返回NULL
+static struct timer_node *
+hash_find(struct timer *T, uint32_t handle, int session) {
+	struct timer_node *node = T->hash[hash_index(T, handle, session)];
+	while (node) {
+		struct timer_event *event = (struct timer_event *)(node+1);
+		if (event->handle == handle && event->session == session) {
+			return node;
+		}
+		node = node->hnext;
+	}
+	return NULL;
+}
+
+static void
+hash_remove(struct timer *T, struct timer_node *node) {
+	struct timer_event *event = (struct timer_event *)(node+1);
+	struct timer_node **p = &T->hash[hash_index(T, event->handle, event->session)];
+	while (*p) {
+		if (*p == node) {
+			*p = node->hnext;
+			--T->hash_count;
+			return;
+		}
+		p = &(*p)->hnext;
+	}
 }
 
 //添加节点，将节点触发的时间和当前时间相比小于256的节点添加到near数组中，
@@ -82,7 +204,7 @@ add_node(struct timer *T,struct timer_node *node) {
 	
 	//TIME_NEAR_MASK=0xff，如果高24位相等则将该节点添加到底8位中对应的链表
 	if ((time|TIME_NEAR_MASK)==(current_time|TIME_NEAR_MASK)) {		
-		link(&T->near[time&TIME_NEAR_MASK],node);	//将该节点加入低8位对应的链表
+		link_node(&T->near[time&TIME_NEAR_MASK],node);	//将该节点加入低8位对应的链表
 	} else {
 		int i;
 		uint32_t mask=TIME_NEAR << TIME_LEVEL_SHIFT;		//TIME_NEAR=256，TIME_LEVEL_SHIFT=6初始化为低14位的掩码
@@ -94,21 +216,53 @@ add_node(struct timer *T,struct timer_node *node) {
 		}
 
 		//将该节点加入高24位对应的链表 TIME_NEAR_SHIFT=8，TIME_LEVEL_MASK=0x3f
-		link(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
+		link_node(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
 	}
 }
 
-//向链表中添加节点，time的单位为1/100秒
+static uint64_t gettime();
+
+//设置定时器线程在时间片wake醒来，需要持有S->lock
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-	//分配一个节点timer_node和附加的timer_event的内存块
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);	
-	memcpy(node+1,arg,sz);
+timer_arm(struct timer_set *S, uint32_t wake) {
+	S->wake = wake;
+#if defined(__linux__)
+	if (S->fd >= 0) {
+		uint64_t ms = (S->base + wake) * S->tick;
+		struct itimerspec ts;
+		memset(&ts, 0, sizeof(ts));
+		ts.it_value.tv_sec = ms / 1000;
+		ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+		timerfd_settime(S->fd, TFD_TIMER_ABSTIME, &ts, NULL);
+	}
+#endif
+}
+
+//向链表中添加节点，time的单位为时间片
+static void
+timer_add(struct timer *T,struct timer_event *event,int time) {
+	//从对象池分配一个节点timer_node和附加的timer_event的内存块
+	struct timer_node *node = (struct timer_node *)skynet_pool_alloc(TI->pool);
+	memcpy(node+1,event,sizeof(*event));
+	uint64_t now = gettime();
 
 	SPIN_LOCK(T);
 
-		node->expire=time+T->time;			//记录回复的时间片
+		// T->time may fall behind the clock while the timer thread sleeps, so count from the clock.
+		uint32_t current = (uint32_t)(now - TI->base);
+		if ((int32_t)(current - T->time) < 0) {
+			current = T->time;
+		}
+		node->expire=time+current;			//记录回复的时间片
 		add_node(T,node);					//添加节点到相应的链表
+		hash_insert(T,node);				//记录节点，用于取消
+		if ((int32_t)(node->expire - TI->wake) < 0) {	//比定时器线程醒来的时间早，提前唤醒
+			SPIN_LOCK(TI);
+			if ((int32_t)(node->expire - TI->wake) < 0) {
+				timer_arm(TI, node->expire);
+			}
+			SPIN_UNLOCK(TI);
+		}
 
 	SPIN_UNLOCK(T);
 }
@@ -148,11 +302,63 @@ timer_shift(struct timer *T) {
 	}
 }
 
+static int
+batch_compare(const void *a, const void *b) {
+	const struct timer_batch *x = a;
+	const struct timer_batch *y = b;
+	if (x->handle != y->handle) {
+		return x->handle < y->handle ? -1 : 1;
+	}
+	return x->index - y->index;
+}
+
+//每个服务的定时合并为一条消息，消息内容为session数组
+static void
+dispatch_batch(struct timer_batch *batch, int n) {
+	qsort(batch, n, sizeof(*batch), batch_compare);
+	int i = 0;
+	while (i < n) {
+		int j = i + 1;
+		while (j < n && batch[j].handle == batch[i].handle) {
+			++j;
+		}
+		int k;
+		int *session = skynet_malloc((j - i) * sizeof(int));
+		for (k=i;k<j;k++) {
+			session[k-i] = batch[k].session;
+		}
+		struct skynet_message message;
+		message.source = 0;
+		message.session = 0;
+		message.data = session;
+		message.sz = (size_t)(j - i) * sizeof(int) | ((size_t)PTYPE_TIMER << MESSAGE_TYPE_SHIFT);
+		if (skynet_context_push(batch[i].handle, &message)) {
+			skynet_free(session);
+		}
+		i = j;
+	}
+}
+
 //处理链表中各个节点的消息，将消息分发到对应的服务
 static inline void
 dispatch_list(struct timer_node *current) {
+	int n = 0;
 	do {
 		struct timer_event * event = (struct timer_event *)(current+1);
+		if (event->coalesce) {
+			if (n >= TI->batch_cap) {
+				TI->batch_cap = TI->batch_cap ? TI->batch_cap * 2 : 64;
+				TI->batch = skynet_realloc(TI->batch, TI->batch_cap * sizeof(struct timer_batch));
+			}
+			TI->batch[n].handle = event->handle;
+			TI->batch[n].session = event->session;
+			TI->batch[n].index = n;
+			++n;
+			struct timer_node * temp = current;
+			current=current->next;
+			skynet_pool_free(TI->pool, temp);
+			continue;
+		}
 		struct skynet_message message;
 		message.source = 0;
 		message.session = event->session;
@@ -163,8 +369,11 @@ dispatch_list(struct timer_node *current) {
 		
 		struct timer_node * temp = current;
 		current=current->next;		//获取链表的下一个节点
-		skynet_free(temp);			//释放处理过的节点的内存
+		skynet_pool_free(TI->pool, temp);			//释放处理过的节点的内存
 	} while (current);
+	if (n > 0) {
+		dispatch_batch(TI->batch, n);
+	}
 }
 
 //检查当前的时间片的低8位对应的数组元素的链表是否为空，不为空则取出
@@ -172,8 +381,12 @@ static inline void
 timer_execute(struct timer *T) {
 	int idx = T->time & TIME_NEAR_MASK;		//取低8位对应的值
 	
-	while (T->near[idx].head.next) {		//如果低8位值对应的数组元素有链表，则取出
+	while (!link_empty(&T->near[idx])) {		//如果低8位值对应的数组元素有链表，则取出
 		struct timer_node *current = link_clear(&T->near[idx]);		//取出对应的链表
+		struct timer_node *n;
+		for (n=current;n;n=n->next) {	//已经触发的节点不能再取消
+			hash_remove(T, n);
+		}
 		SPIN_UNLOCK(T);
 		// dispatch_list don't need lock T
 		dispatch_list(current);		//处理取出链表中各个节点的消息，将消息分发到对应的服务
@@ -181,6 +394,20 @@ timer_execute(struct timer *T) {
 	}
 }
 
+//获得到下一个可能有事件的时间片的距离：near中下一个非空的链表，或者需要移动高位链表的时候
+static uint32_t
+timer_next(struct timer *T) {
+	uint32_t idx = T->time & TIME_NEAR_MASK;
+	uint32_t n = TIME_NEAR - idx;
+	uint32_t i;
+	for (i=1;i<n;i++) {
+		if (!link_empty(&T->near[(idx + i) & TIME_NEAR_MASK])) {
+			return i;
+		}
+	}
+	return n;
+}
+
 //刷新时间片
 static void 
 timer_update(struct timer *T) {
@@ -197,34 +424,33 @@ timer_update(struct timer *T) {
 	SPIN_UNLOCK(T);
 }
 
-//创建一个计时信息结构体
-static struct timer *
-timer_create_timer() {
-	struct timer *r=(struct timer *)skynet_malloc(sizeof(struct timer));
+//初始化一个时间轮
+static void
+timer_init(struct timer *r) {
 	memset(r,0,sizeof(*r));
 
 	int i,j;
 
 	for (i=0;i<TIME_NEAR;i++) {
-		link_clear(&r->near[i]);	//清空链表
+		link_init(&r->near[i]);	//清空链表
 	}
 
 	for (i=0;i<4;i++) {
 		for (j=0;j<TIME_LEVEL;j++) {
-			link_clear(&r->t[i][j]);	//清空链表
+			link_init(&r->t[i][j]);	//清空链表
 		}
 	}
 
-	SPIN_INIT(r)
-
-	r->current = 0;
+	r->hash_size = DEFAULT_HASH_SIZE;
+	r->hash = skynet_malloc(r->hash_size * sizeof(struct timer_node *));
+	memset(r->hash, 0, r->hash_size * sizeof(struct timer_node *));
 
-	return r;
+	SPIN_INIT(r)
 }
 
-//定时回复，time的单位为1/100秒
-int
-skynet_timeout(uint32_t handle, int time, int session) {
+//定时回复，time的单位为时间片
+static int
+timeout_tick(uint32_t handle, int64_t time, int session, int coalesce) {
 	if (time <= 0) {	//如果时间小于或等于0，则立刻回复消息
 		struct skynet_message message;
 		message.source = 0;
@@ -239,12 +465,49 @@ skynet_timeout(uint32_t handle, int time, int session) {
 		struct timer_event event;
 		event.handle = handle;
 		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		event.coalesce = coalesce;
+		if (time > INT32_MAX) {	// the wheel can't hold a longer delay
+			time = INT32_MAX;
+		}
+		timer_add(&TI->wheel[handle % TI->count], &event, (int)time);
 	}
 
 	return session;
 }
 
+//定时回复，time的单位为1/100秒
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	return timeout_tick(handle, (int64_t)time * 10 / TI->tick, session, 0);
+}
+
+//取消还没有触发的定时，成功返回1，已经触发或者不存在返回0
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	struct timer *T = &TI->wheel[handle % TI->count];
+	SPIN_LOCK(T);
+	struct timer_node *node = hash_find(T, handle, session);
+	if (node) {
+		hash_remove(T, node);
+		link_remove(node);
+	}
+	SPIN_UNLOCK(T);
+	if (node == NULL) {
+		return 0;
+	}
+	skynet_pool_free(TI->pool, node);
+	return 1;
+}
+
+//定时回复，time的单位为毫秒，不足一个时间片的部分向上取整，coalesce不为0时合并投递
+int
+skynet_timeout_ms(uint32_t handle, int64_t time, int session, int coalesce) {
+	if (time <= 0) {
+		return timeout_tick(handle, 0, session, 0);
+	}
+	return timeout_tick(handle, (time + TI->tick - 1) / TI->tick, session, coalesce);
+}
+
 // centisecond: 1/100 seconds  cs:改为存1/100秒
 //获得系统的实时时间，从UTC1970-1-1 0:0:0开始计时，精确到1/100秒
 static void
@@ -262,40 +525,90 @@ systime(uint32_t *sec, uint32_t *cs) {
 #endif
 }
 
-//获得从系统启动开始计时的时间，不受系统时间被用户改变的影响，精确到1/100秒
+//获得从系统启动开始计时的时间，不受系统时间被用户改变的影响，单位为tick毫秒
 static uint64_t
 gettime() {
 	uint64_t t;
 #if !defined(__APPLE__)
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 100;		//将秒的部分乘以100
-	t += ti.tv_nsec / 10000000;			//小于秒的部分，现在一个单位就是1/100秒
+	t = (uint64_t)ti.tv_sec * 1000;		//将秒的部分乘以1000
+	t += ti.tv_nsec / 1000000;			//小于秒的部分，现在一个单位就是毫秒
 #else
 	struct timeval tv;
 	gettimeofday(&tv, NULL);
-	t = (uint64_t)tv.tv_sec * 100;
-	t += tv.tv_usec / 10000;
+	t = (uint64_t)tv.tv_sec * 1000;
+	t += tv.tv_usec / 1000;
 #endif
-	return t;
+	return t / TI->tick;
 }
 
 //刷新时间
 void
 skynet_updatetime(void) {
-	uint64_t cp = gettime();	//获得从系统启动开始计时的时间，不受系统时间被用户改变的影响，精确到1/100秒
+	uint64_t cp = gettime();	//获得从系统启动开始计时的时间，不受系统时间被用户改变的影响，单位为tick毫秒
 	if(cp < TI->current_point) {	//如果
 		skynet_error(NULL, "time diff error: change from %lld to %lld", cp, TI->current_point);
 		TI->current_point = cp;
+		SPIN_LOCK(TI);
+		TI->base = cp - TI->wheel[0].time;
+		SPIN_UNLOCK(TI);
 	} else if (cp != TI->current_point) {
-		uint32_t diff = (uint32_t)(cp - TI->current_point);		//从系统启动到目前的时间差，精确到1/100秒
-		TI->current_point = cp;				//记录下当前的时间，不受系统时间被用户改变的影响，精确到1/100秒
-		TI->current += diff;	
-		int i;
+		uint32_t diff = (uint32_t)(cp - TI->current_point);		//从系统启动到目前的时间差，单位为tick毫秒
+		TI->current_point = cp;				//记录下当前的时间，不受系统时间被用户改变的影响，单位为tick毫秒
+		int i,j;
 		for (i=0;i<diff;i++) {
-			timer_update(TI);		//刷新时间片
+			for (j=0;j<TI->count;j++) {
+				timer_update(&TI->wheel[j]);		//刷新时间片，所有的时间轮一起前进
+			}
+		}
+	}
+}
+
+//定时器线程等待到下一个可能有事件的时间片，有更早的定时事件加入时会被提前唤醒
+void
+skynet_timer_wait(void) {
+	struct timer_set *S = TI;
+	uint32_t time = S->wheel[0].time;	// only the timer thread changes it
+	uint32_t next = MAX_WAIT / S->tick;
+	// timer_add arms the timerfd itself if it adds an earlier timer while we are scanning the wheels
+	SPIN_LOCK(S);
+	S->wake = time + next;
+	SPIN_UNLOCK(S);
+	int i;
+	for (i=0;i<S->count;i++) {
+		struct timer *T = &S->wheel[i];
+		SPIN_LOCK(T);
+		uint32_t n = timer_next(T);
+		SPIN_UNLOCK(T);
+		if (n < next) {
+			next = n;
 		}
 	}
+	SPIN_LOCK(S);
+	if ((int32_t)(time + next - S->wake) < 0) {
+		timer_arm(S, time + next);
+	} else {
+		timer_arm(S, S->wake);
+	}
+	SPIN_UNLOCK(S);
+#if defined(__linux__)
+	if (S->fd >= 0) {
+		uint64_t expirations;
+		if (read(S->fd, &expirations, sizeof(expirations)) < 0) {
+			// EINTR, the caller will check the signal and wait again
+		}
+		return;
+	}
+#endif
+	// no timerfd, poll the clock 4 times per tick
+	usleep(S->tick * 250);
+}
+
+//定时器节点对象池的统计信息
+void
+skynet_timer_poolstat(struct skynet_pool_stat *st) {
+	skynet_pool_stat(TI->pool, st);
 }
 
 //获得开始时间，精确到秒
@@ -307,17 +620,44 @@ skynet_starttime(void) {
 //获得从开始时间到当前的时长，精确到1/100秒
 uint64_t 
 skynet_now(void) {
-	return TI->current;
+	// read the clock, because the timer thread may sleep more than one tick
+	return TI->current + (gettime() - TI->origin) * TI->tick / 10;
 }
 
-//初始化系统计时
+//初始化系统计时，tick为一个时间片的毫秒数，shard为时间轮的数量
 void 
-skynet_timer_init(void) {
-	TI = timer_create_timer();			//新建一个计时信息结构体
+skynet_timer_init(int tick, int shard) {
+	if (tick <= 0 || tick > DEFAULT_TICK || DEFAULT_TICK % tick != 0) {
+		fprintf(stderr, "Invalid timer tick %d ms, use %d ms\n", tick, DEFAULT_TICK);
+		tick = DEFAULT_TICK;
+	}
+	if (shard < 1) {
+		shard = 1;
+	}
+	TI = (struct timer_set *)skynet_malloc(sizeof(struct timer_set));	//新建一个计时信息结构体
+	memset(TI, 0, sizeof(*TI));
+	TI->wheel = (struct timer *)skynet_malloc(shard * sizeof(struct timer));
+	TI->count = shard;
+	int i;
+	for (i=0;i<shard;i++) {
+		timer_init(&TI->wheel[i]);
+	}
+	SPIN_INIT(TI)
+	TI->pool = skynet_pool_new(sizeof(struct timer_node) + sizeof(struct timer_event));
+	TI->tick = tick;
 	uint32_t current = 0;
 	systime(&TI->starttime, &current);	//获取系统初始化时的UTC时间
 	TI->current = current;
 	TI->current_point = gettime();	//获得系统启动时的CPU时间
+	TI->origin = TI->current_point;
+	TI->base = TI->current_point;
+	TI->fd = -1;
+#if defined(__linux__)
+	TI->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (TI->fd < 0) {
+		fprintf(stderr, "timerfd_create failed, poll the clock instead\n");
+	}
+#endif
 }
 
 // for profile
@@ -343,3 +683,17 @@ skynet_thread_time(void) {
 	return (uint64_t)(aTaskInfo.user_time.seconds) + (uint64_t)aTaskInfo.user_time.microseconds;
 #endif
 }
+
+//获得从系统启动开始计时的时间，不受系统时间被用户改变的影响，精确到微秒
+uint64_t
+skynet_monotonic_time(void) {
+#if !defined(__APPLE__)
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+	return (uint64_t)ti.tv_sec * MICROSEC + (uint64_t)ti.tv_nsec / (NANOSEC / MICROSEC);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * MICROSEC + (uint64_t)tv.tv_usec;
+#endif
+}
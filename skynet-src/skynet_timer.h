@@ -3,11 +3,20 @@
 
 #include <stdint.h>
 
-int skynet_timeout(uint32_t handle, int time, int session);
+int skynet_timeout(uint32_t handle, int time, int session);	// time in centisecond
+// time in millisecond, rounded up to the timer tick. If coalesce is set, timeouts of the same service
+// expiring together are delivered as one PTYPE_TIMER message carrying an array of int sessions.
+int skynet_timeout_ms(uint32_t handle, int64_t time, int session, int coalesce);
+int skynet_timeout_cancel(uint32_t handle, int session);	// return 1 if the timer is removed before it fires
 void skynet_updatetime(void);
+void skynet_timer_wait(void);
 uint32_t skynet_starttime(void);
 uint64_t skynet_thread_time(void);	// for profile, in micro second
+uint64_t skynet_monotonic_time(void);	// for profile, in micro second
 
-void skynet_timer_init(void);
+struct skynet_pool_stat;
+void skynet_timer_poolstat(struct skynet_pool_stat *st);
+
+void skynet_timer_init(int tick, int shard);	// tick in millisecond, 1, 2, 5 or 10; shard wheels, each with its own lock
 
 #endif
@@ -29,4 +29,6 @@ static void sp_nonblocking(int sock);
 #include "socket_kqueue.h"
 #endif
 
+#include "socket_uring.h"
+
 #endif
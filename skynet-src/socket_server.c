@@ -1,3 +1,7 @@
+#if defined(__linux__)
+#define _GNU_SOURCE		// for recvmmsg and sendmmsg
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -7,6 +11,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,12 +21,18 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <sched.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
 #define MAX_SOCKET_P 16
 #define MAX_EVENT 64						//epoll一次最多返回的事件数量
 #define MIN_READ_BUFFER 64					//从套接字中一次性最少读取的字节数
+#define MAX_IOV 64							//一次writev最多合并的写缓存数量
 
 //用于标记socket结构体的状态
 #define SOCKET_TYPE_INVALID 0				//socket结构体未被使用
@@ -49,6 +60,10 @@
 
 #define MAX_UDP_PACKAGE 65535				//接收UDP数据包的最大长度
 
+#define UDP_BATCH 16						//一次recvmmsg/sendmmsg最多处理的UDP数据包数量
+
+#define CTRL_QUEUE_SIZE 1024				//每个网络线程的命令队列长度，必须是2的幂
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -87,6 +102,7 @@ struct socket {							//套接字相关信息结构体
 	uint8_t protocol;					//协议类型
 	uint8_t type;						//socket结构体所处的状态，绑定套接字时，即套接字的状态
 	uint16_t udpconnecting;				//大于0标记该套接字正在进行关联ip地址操作，用于UDP协议
+	uint8_t udpbatch;					//为1时一次接收多个UDP数据包，合并成一个SOCKET_UDPBATCH返回
 	int64_t warn_size;					//阈值，写缓存超过的阈值，每超过一次阈值就会翻倍
 	union {
 		int size;						//在 TCP 协议下使用, 表示一次性最多读取的字节数
@@ -98,21 +114,45 @@ struct socket {							//套接字相关信息结构体
 	size_t dw_size;						//已发送一部分的全部数据的大小
 };
 
-//全局的信息
-struct socket_server {
-	int recvctrl_fd;					//读管道fd
-	int sendctrl_fd;					//写管道fd
-	int checkctrl;						//默认值为1，是否需要检查管道中的命令的标记
+//命令队列中的一个命令，seq等于序号+1时表示命令已经写好
+struct ctrl_slot {
+	volatile unsigned seq;
+	uint8_t type;						//命令的类型
+	uint8_t len;						//命令附带的数据长度
+	uint8_t buffer[256];				//命令附带的数据
+};
+
+// Bounded MPSC ring, any thread pushes commands and only the socket thread pops them.
+struct ctrl_queue {
+	volatile unsigned tail;				//下一个写入的序号，由写入的线程原子递增
+	unsigned head;						//下一个读取的序号，只有网络线程访问
+	struct ctrl_slot slot[CTRL_QUEUE_SIZE];
+};
+
+//每个网络线程一个，只处理 HASH_ID(id) % poller_n 等于自己序号的套接字
+struct socket_poller {
+	int recvctrl_fd;					//唤醒网络线程的eventfd（非linux为读管道fd）
+	int sendctrl_fd;					//写入唤醒通知的fd，使用eventfd时与recvctrl_fd相同
+	int ctrl_signal;					//为1表示已经发出唤醒通知，网络线程还没有处理
+	int checkctrl;						//默认值为1，是否需要检查命令队列中的命令的标记
+	struct ctrl_queue *cq;				//命令队列
 	poll_fd event_fd;					//epoll句柄
-	int alloc_id;						//当前分配到的socket ID
+	struct uring_poll *uring;			//不为NULL时使用io_uring代替epoll
 	int event_n;						//epoll触发的事件数量
 	int event_index;					//当前已经处理的epoll事件的数量
-	struct socket_object_interface soi;	//初始化发送对象时用
 	struct event ev[MAX_EVENT];			//事件的相关数据
-	struct socket slot[MAX_SOCKET];		//所有套接字相关的信息
 	char buffer[MAX_INFO];				//open_socket发起TCP连接时，用于保存套接字的对端IP地址，如果是客户端套接字保存客户端的ip地址和端口号
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];	//接收UDP数据
-	fd_set rfds;						//select的读描述符集合
+	struct udp_batch *udpbatch;			//批量接收UDP数据的缓存，第一次使用时分配
+};
+
+//全局的信息
+struct socket_server {
+	int alloc_id;						//当前分配到的socket ID
+	int poller_n;						//网络线程的数量
+	struct socket_poller *poller;		//每个网络线程的epoll和命令管道
+	struct socket_object_interface soi;	//初始化发送对象时用
+	struct socket slot[MAX_SOCKET];		//所有套接字相关的信息
 };
 
 struct request_open {
@@ -168,6 +208,11 @@ struct request_setopt {
 	int value;
 };
 
+struct request_udpbatch {
+	int id;
+	int enable;
+};
+
 struct request_udp {
 	int id;
 	int fd;
@@ -176,7 +221,7 @@ struct request_udp {
 };
 
 /*
-	The first byte is TYPE
+	The type of a ctrl command
 
 	S Start socket
 	B Bind socket
@@ -190,10 +235,10 @@ struct request_udp {
 	T Set opt
 	U Create UDP socket
 	C set udp address
+	M Set udp batch mode
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy	header[6]存储type  header[7]存储len
 	union {
 		char buffer[256];
 		struct request_open open;
@@ -206,8 +251,8 @@ struct request_package {
 		struct request_setopt setopt;
 		struct request_udp udp;
 		struct request_setudp set_udp;
+		struct request_udpbatch udpbatch;
 	} u;
-	uint8_t dummy[256];
 };
 
 union sockaddr_all {		//各种类型的套接字地址
@@ -216,6 +261,17 @@ union sockaddr_all {		//各种类型的套接字地址
 	struct sockaddr_in6 v6;	//ipv6 地址的结构定义
 };
 
+struct udp_batch {			//批量接收UDP数据用的缓存
+#if defined(__linux__)
+	struct mmsghdr msg[UDP_BATCH];
+#endif
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all addr[UDP_BATCH];			//每个数据包的对端地址
+	socklen_t addrsz[UDP_BATCH];				//对端地址的长度
+	int sz[UDP_BATCH];							//每个数据包的长度
+	uint8_t buffer[UDP_BATCH][MAX_UDP_PACKAGE];	//每个数据包的内容
+};
+
 struct send_object {
 	void * buffer;
 	int sz;
@@ -337,35 +393,204 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
-//初始化全局的套接字服务信息
-struct socket_server * 
-socket_server_create() {
-	int i;
+//套接字所属的网络线程，由套接字信息在slot中的位置决定
+static inline struct socket_poller *
+slot_poller(struct socket_server *ss, struct socket *s) {
+	return &ss->poller[(s - ss->slot) % ss->poller_n];
+}
+
+//id对应的套接字所属的网络线程
+static inline struct socket_poller *
+id_poller(struct socket_server *ss, int id) {
+	return &ss->poller[HASH_ID(id) % ss->poller_n];
+}
+
+//创建唤醒网络线程用的fd，linux下为一个eventfd，其它平台为一对管道
+static int
+ctrl_fd(int fd[2]) {
+#if defined(__linux__)
+	int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		return -1;
+	}
+	fd[0] = fd[1] = efd;
+	return 0;
+#else
+	if (pipe(fd)) {
+		return -1;
+	}
+	sp_nonblocking(fd[0]);
+	return 0;
+#endif
+}
+
+static void
+ctrl_fd_close(struct socket_poller *p) {
+	if (p->sendctrl_fd != p->recvctrl_fd) {
+		close(p->sendctrl_fd);
+	}
+	close(p->recvctrl_fd);
+}
+
+//下面的函数根据网络线程使用的是io_uring还是epoll调用相应的实现
+static int
+poll_add(struct socket_poller *p, int sock, void *ud) {
+	if (p->uring)
+		return su_add(p->uring, sock, ud);
+	return sp_add(p->event_fd, sock, ud);
+}
+
+static void
+poll_del(struct socket_poller *p, int sock) {
+	if (p->uring)
+		su_del(p->uring, sock);
+	else
+		sp_del(p->event_fd, sock);
+}
+
+static void
+poll_write(struct socket_poller *p, int sock, void *ud, bool enable) {
+	if (p->uring)
+		su_write(p->uring, sock, ud, enable);
+	else
+		sp_write(p->event_fd, sock, ud, enable);
+}
+
+static int
+poll_wait(struct socket_poller *p, struct event *e, int max) {
+	if (p->uring)
+		return su_wait(p->uring, e, max);
+	return sp_wait(p->event_fd, e, max);
+}
+
+//io_uring下已连接的TCP套接字由io_uring读取数据，监听套接字由io_uring接受连接，epoll下什么也不做
+static void
+poll_mode(struct socket_poller *p, struct socket *s) {
+	if (p->uring == NULL || s->protocol != PROTOCOL_TCP)
+		return;
+	if (s->type == SOCKET_TYPE_CONNECTED)
+		su_mode(p->uring, s->fd, SU_RECV);
+	else if (s->type == SOCKET_TYPE_LISTEN)
+		su_mode(p->uring, s->fd, SU_ACCEPT);
+}
+
+//读取套接字上的数据，io_uring已经读取完成时直接取出结果，否则调用read，*buffer由调用者释放
+static int
+poll_read(struct socket_poller *p, int fd, char **buffer, int sz) {
+	int n;
+	if (p->uring && su_read(p->uring, fd, (void **)buffer, &n)) {
+		return n;
+	}
+	*buffer = MALLOC(sz);
+	return (int)read(fd, *buffer, sz);
+}
+
+//接受一个连接，io_uring已经接受完成时直接取出结果，否则调用accept
+static int
+poll_accept(struct socket_poller *p, int fd, struct sockaddr *addr, socklen_t *len) {
+	int client_fd;
+	if (p->uring && su_accept(p->uring, fd, addr, len, &client_fd)) {
+		return client_fd;
+	}
+	return accept(fd, addr, len);
+}
+
+static void
+poll_release(struct socket_poller *p) {
+	if (p->uring)
+		su_release(p->uring);
+	else
+		sp_release(p->event_fd);
+}
+
+//创建一个epoll（uring为真时优先使用io_uring），命令队列和唤醒用的eventfd，失败返回-1
+static int
+poller_init(struct socket_poller *p, int uring) {
 	int fd[2];
-	poll_fd efd = sp_create();		//创建一个epoll
-	if (sp_invalid(efd)) {
-		fprintf(stderr, "socket-server: create event pool failed.\n");
-		return NULL;
+	p->uring = NULL;
+	if (uring) {
+		p->uring = su_create(MAX_EVENT * 4);
+		if (p->uring == NULL) {
+			fprintf(stderr, "socket-server: io_uring unavailable, use epoll.\n");
+		}
 	}
-	if (pipe(fd)) {			//产生一个读管道和一个写管道
-		sp_release(efd);
-		fprintf(stderr, "socket-server: create socket pair failed.\n");
-		return NULL;
+	if (p->uring == NULL) {
+		poll_fd efd = sp_create();		//创建一个epoll
+		if (sp_invalid(efd)) {
+			fprintf(stderr, "socket-server: create event pool failed.\n");
+			return -1;
+		}
+		p->event_fd = efd;
+	}
+	if (ctrl_fd(fd)) {
+		poll_release(p);
+		fprintf(stderr, "socket-server: create ctrl fd failed.\n");
+		return -1;
 	}
-	if (sp_add(efd, fd[0], NULL)) {		//将读管道添加到epoll中进行可读事件监听
+	if (poll_add(p, fd[0], NULL)) {		//将唤醒用的fd添加到epoll中进行可读事件监听
 		// add recvctrl_fd to event poll
 		fprintf(stderr, "socket-server: can't add server fd to event pool.\n");
-		close(fd[0]);
-		close(fd[1]);
-		sp_release(efd);
-		return NULL;
+		p->recvctrl_fd = fd[0];
+		p->sendctrl_fd = fd[1];
+		ctrl_fd_close(p);
+		poll_release(p);
+		return -1;
+	}
+	p->recvctrl_fd = fd[0];
+	p->sendctrl_fd = fd[1];
+	p->ctrl_signal = 0;
+	p->checkctrl = 1;
+	p->event_n = 0;					//epoll中监听到的事件数量
+	p->event_index = 0;				//当前处理到第几个事件
+	p->udpbatch = NULL;
+
+	struct ctrl_queue *q = MALLOC(sizeof(*q));
+	int i;
+	for (i=0;i<CTRL_QUEUE_SIZE;i++) {
+		q->slot[i].seq = i;			//seq等于序号时表示可以写入
+	}
+	q->head = 0;
+	q->tail = 0;
+	p->cq = q;
+	return 0;
+}
+
+static void
+poller_release(struct socket_poller *p) {
+	ctrl_fd_close(p);
+	poll_release(p);
+	FREE(p->cq);
+	FREE(p->udpbatch);
+}
+
+//初始化全局的套接字服务信息
+struct socket_server * 
+socket_server_create() {
+	return socket_server_create_thread(1, 0);
+}
+
+//初始化全局的套接字服务信息，创建n个网络线程使用的epoll，套接字按id分配给各个线程
+//uring为真时使用io_uring，系统不支持时退回epoll
+struct socket_server * 
+socket_server_create_thread(int n, int uring) {
+	int i;
+	if (n < 1) {
+		n = 1;
+	}
+	struct socket_poller *poller = MALLOC(n * sizeof(*poller));
+	for (i=0;i<n;i++) {
+		if (poller_init(&poller[i], uring)) {
+			while (--i >= 0) {
+				poller_release(&poller[i]);
+			}
+			FREE(poller);
+			return NULL;
+		}
 	}
 
 	struct socket_server *ss = MALLOC(sizeof(*ss));
-	ss->event_fd = efd;				//epoll句柄
-	ss->recvctrl_fd = fd[0];		//读管道fd
-	ss->sendctrl_fd = fd[1];		//写管道fd
-	ss->checkctrl = 1;
+	ss->poller_n = n;
+	ss->poller = poller;
 
 	for (i=0;i<MAX_SOCKET;i++) {	//MAX_SOCKET=2^16	对存储套接字的相关信息结构进行初始化
 		struct socket *s = &ss->slot[i];
@@ -374,11 +599,7 @@ socket_server_create() {
 		clear_wb_list(&s->low);				//清空低优先级写缓存队列
 	}
 	ss->alloc_id = 0;						//记录当前分配可以分配的套接字信息的位置
-	ss->event_n = 0;						//epoll中监听到的事件数量
-	ss->event_index = 0;					//当前处理到第几个事件
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);						//清空描述符集合
-	assert(ss->recvctrl_fd < FD_SETSIZE);	//读管道是否有效
 
 	return ss;
 }
@@ -418,7 +639,7 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
 	if (s->type != SOCKET_TYPE_PACCEPT && s->type != SOCKET_TYPE_PLISTEN) {
-		sp_del(ss->event_fd, s->fd);		//删除套接字的事件监听
+		poll_del(slot_poller(ss, s), s->fd);		//删除套接字的事件监听
 	}
 	socket_lock(l);	//所得锁
 	if (s->type != SOCKET_TYPE_BIND) {
@@ -447,9 +668,10 @@ socket_server_release(struct socket_server *ss) {
 			force_close(ss, s, &l, &dummy);
 		}
 	}
-	close(ss->sendctrl_fd);
-	close(ss->recvctrl_fd);
-	sp_release(ss->event_fd);
+	for (i=0;i<ss->poller_n;i++) {
+		poller_release(&ss->poller[i]);
+	}
+	FREE(ss->poller);
 	FREE(ss);
 }
 
@@ -468,7 +690,7 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	assert(s->type == SOCKET_TYPE_RESERVE);
 
 	if (add) {
-		if (sp_add(ss->event_fd, fd, s)) {	//添加到epoll对套接字的可读事件的监听
+		if (poll_add(slot_poller(ss, s), fd, s)) {	//添加到epoll对套接字的可读事件的监听
 			s->type = SOCKET_TYPE_INVALID;
 			return NULL;
 		}
@@ -486,6 +708,7 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	spinlock_init(&s->dw_lock);	//锁
 	s->dw_buffer = NULL;		//保存未发送完，或不成功的数据
 	s->dw_size = 0;				//发送不成功的数据的大小
+	s->udpbatch = 0;
 	return s;
 }
 
@@ -550,16 +773,18 @@ open_socket(struct socket_server *ss, struct request_open * request, struct sock
 
 	if(status == 0) {	//为0说明已经连接
 		ns->type = SOCKET_TYPE_CONNECTED;	//套接字状态改为已经连接
+		poll_mode(slot_poller(ss, ns), ns);
 		struct sockaddr * addr = ai_ptr->ai_addr;
 		void * sin_addr = (ai_ptr->ai_family == AF_INET) ? (void*)&((struct sockaddr_in *)addr)->sin_addr : (void*)&((struct sockaddr_in6 *)addr)->sin6_addr;
-		if (inet_ntop(ai_ptr->ai_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {	//保存套接字的对端的ip地址
-			result->data = ss->buffer;	//保存IP地址
+		struct socket_poller *p = slot_poller(ss, ns);
+		if (inet_ntop(ai_ptr->ai_family, sin_addr, p->buffer, sizeof(p->buffer))) {	//保存套接字的对端的ip地址
+			result->data = p->buffer;	//保存IP地址
 		}
 		freeaddrinfo( ai_list );
 		return SOCKET_OPEN;
 	} else {		//正在连接中
 		ns->type = SOCKET_TYPE_CONNECTING;	//套接字状态为正在连接中
-		sp_write(ss->event_fd, ns->fd, ns, true);	//将套接字的监听事件改为可读可写
+		poll_write(slot_poller(ss, ns), ns->fd, ns, true);	//将套接字的监听事件改为可读可写
 	}
 
 	freeaddrinfo( ai_list );	//释放ai_list
@@ -570,39 +795,68 @@ _failed:
 	return SOCKET_ERR;
 }
 
-//TCP发送指定写缓存队列的数据，一个一个节点的数据进行发送，
-//发送过程中碰到中断继续执行，如果一个节点只发送成功一部分数据，或者没发送成功返回-1
+//从写缓存队列的头部去掉已经发送的sz字节，发送完的节点被释放，只发送一部分的节点移动ptr
+//返回剩余没有消耗掉的字节数，即属于后面队列的部分
+static ssize_t
+consume_list(struct socket_server *ss, struct wb_list *list, ssize_t sz) {
+	while (list->head) {
+		struct write_buffer * tmp = list->head;
+		if (sz < tmp->sz) {					//该节点只发送出去一部分
+			tmp->ptr += sz;
+			tmp->sz -= sz;
+			return 0;
+		}
+		sz -= tmp->sz;
+		list->head = tmp->next;				//继续处理下一个节点
+		write_buffer_free(ss,tmp);			//释放已经发送的节点缓存
+	}
+	list->tail = NULL;
+	return sz;
+}
+
+//把写缓存队列中的节点依次放入iov，从第n个开始，返回放入后的数量，total累加数据长度
+static int
+fill_iov(struct wb_list *list, struct iovec *iov, int n, size_t *total) {
+	struct write_buffer * tmp;
+	for (tmp = list->head; tmp && n < MAX_IOV; tmp = tmp->next) {
+		iov[n].iov_base = tmp->ptr;
+		iov[n].iov_len = tmp->sz;
+		*total += tmp->sz;
+		++n;
+	}
+	return n;
+}
+
+//TCP发送写缓存队列的数据，先高优先级后低优先级，每次把最多MAX_IOV个节点合并成一次writev，
+//发送过程中碰到中断继续执行，如果只发送成功一部分数据，或者没发送成功返回-1，已发送的部分从队列中去掉
 //发送不成功的其他情况则关闭套接字，返回SOCKET_CLOSE
 static int
-send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
-	while (list->head) {
-		struct write_buffer * tmp = list->head;		//获得写缓存队列的头节点
-		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);	//发送数据
-			if (sz < 0) {						//数据发送不成功
-				switch(errno) {
-				case EINTR:						//中断
-					continue;
-				case AGAIN_WOULDBLOCK:			//说明发送数据的缓存区已满
-					return -1;
-				}
-				force_close(ss,s,l,result);		//关闭套接字
-				return SOCKET_CLOSE;
-			}
-			s->wb_size -= sz;					//随着发送出去的数据减少记录的缓存区数据大小
-			if (sz != tmp->sz) {				//如果数据只发送出去一部分，说明发送数据的缓存区已满
-				tmp->ptr += sz;
-				tmp->sz -= sz;
+send_list_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	struct iovec iov[MAX_IOV];
+	for (;;) {
+		size_t total = 0;
+		int n = fill_iov(&s->high, iov, 0, &total);
+		n = fill_iov(&s->low, iov, n, &total);
+		if (n == 0) {
+			return -1;
+		}
+		ssize_t sz = writev(s->fd, iov, n);		//发送数据
+		if (sz < 0) {						//数据发送不成功
+			switch(errno) {
+			case EINTR:						//中断
+				continue;
+			case AGAIN_WOULDBLOCK:			//说明发送数据的缓存区已满
 				return -1;
 			}
-			break;
+			force_close(ss,s,l,result);		//关闭套接字
+			return SOCKET_CLOSE;
+		}
+		s->wb_size -= sz;					//随着发送出去的数据减少记录的缓存区数据大小
+		consume_list(ss, &s->low, consume_list(ss, &s->high, sz));
+		if ((size_t)sz != total) {			//如果数据只发送出去一部分，说明发送数据的缓存区已满
+			return -1;
 		}
-		list->head = tmp->next;					//继续发送下一个节点数据
-		write_buffer_free(ss,tmp);				//释放已经发送的节点缓存
 	}
-	list->tail = NULL;
-
-	return -1;
 }
 
 ///从 udp_address 中提取出套接字地址, 此函数支持 PROTOCOL_UDP 和 PROTOCOL_UDPv6 两种形式的地址.
@@ -633,9 +887,51 @@ udp_socket_address(struct socket *s, const uint8_t udp_address[UDP_ADDRESS_SIZE]
 	return 0;
 }
 
-//UDP发送写缓存队列中的数据
+//UDP发送写缓存队列中的数据，linux下每次把最多UDP_BATCH个数据包合并成一次sendmmsg
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+#if defined(__linux__)
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all sa[UDP_BATCH];
+	while (list->head) {
+		struct write_buffer * tmp;
+		int n = 0;
+		for (tmp = list->head; tmp && n < UDP_BATCH; tmp = tmp->next) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msg[n].msg_hdr, 0, sizeof(msg[n].msg_hdr));
+			msg[n].msg_hdr.msg_name = &sa[n];
+			msg[n].msg_hdr.msg_namelen = udp_socket_address(s, tmp->udp_address, &sa[n]);	//获得标准的地址长度，地址存于sa[n]
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+			++n;
+		}
+		int r = sendmmsg(s->fd, msg, n, 0);		//发送数据，返回成功发送的数据包数量
+		if (r < 0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			fprintf(stderr, "socket-server : udp (%d) sendmmsg error %s.\n",s->id, strerror(errno));
+			return -1;
+		}
+		int i;
+		for (i=0;i<r;i++) {
+			tmp = list->head;
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;			//获得下一个节点数据
+			write_buffer_free(ss,tmp);		//释放已经发送的数据
+		}
+		if (r < n) {
+			return -1;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+#else
 	while (list->head) {
 		struct write_buffer * tmp = list->head;	//获取节点数据
 		union sockaddr_all sa;
@@ -667,16 +963,7 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	list->tail = NULL;
 
 	return -1;
-}
-
-//发送写缓存队列中的数据，根据套接字信息中的协议类型来判断是TCP还UDP
-static int
-send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
-	if (s->protocol == PROTOCOL_TCP) {
-		return send_list_tcp(ss, s, list, l, result);	//TCP发送队列中的数据
-	} else {
-		return send_list_udp(ss, s, list, result);
-	}
+#endif
 }
 
 //用来判断写缓存队列的头节点数据是否只发送一部分，只发送一部分返回true,否则返回false
@@ -719,6 +1006,7 @@ send_buffer_empty(struct socket *s) {
 	1. send high list as far as possible.
 	2. If high list is empty, try to send low list.
 	3. If low list head is uncomplete (send a part before), move the head of low list to empty high list (call raise_uncomplete) .
+	   For tcp, step 1 and 2 are merged: both lists are written in order by writev.
 	4. If two lists are both empty, turn off the event. (call check_close)
  */
 //发送写缓存队列中的数据，检查低优先级队列的头节点是否只发送一部分数据
@@ -729,26 +1017,31 @@ send_buffer_empty(struct socket *s) {
 static int
 send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
 	assert(!list_uncomplete(&s->low));	//检查低优先级队列的头节点是否只发送一部分数据
-	// step 1
-	if (send_list(ss,s,&s->high,l,result) == SOCKET_CLOSE) {	//发送高优先级写缓存队列中的数据，根据套接字信息中的协议类型来判断是TCP还UDP
-		return SOCKET_CLOSE;	//套接字已经关闭
+	if (s->protocol == PROTOCOL_TCP) {
+		// step 1 and 2
+		if (send_list_tcp(ss,s,l,result) == SOCKET_CLOSE) {	//合并发送高优先级和低优先级写缓存队列中的数据
+			return SOCKET_CLOSE;	//套接字已经关闭
+		}
+	} else {
+		// step 1
+		send_list_udp(ss,s,&s->high,result);	//发送高优先级写缓存队列中的数据
+		if (s->high.head == NULL && s->low.head != NULL) {
+			// step 2 如果高优先级队列中的数据已经发送完毕，下一步发送低优先级的
+			send_list_udp(ss,s,&s->low,result);
+		}
 	}
 	if (s->high.head == NULL) {
-		// step 2 如果高优先级队列中的数据已经发送完毕，下一步发送低优先级的
 		if (s->low.head != NULL) {
-			if (send_list(ss,s,&s->low,l,result) == SOCKET_CLOSE) {	//发送低优先级写缓存队列中的数据，根据套接字信息中的协议类型来判断是TCP还UDP
-				return SOCKET_CLOSE;	//套接字已经关闭
-			}
 			// step 3
 			if (list_uncomplete(&s->low)) {	
 				//如果低优先级队列的头节点只成功发送一部数据
 				raise_uncomplete(s);	//将低优先级的头节点数据移到高优先级的头节点中
-				return -1;
 			}
+			return -1;		//发送数据的缓存区已满，等待下一次可写事件
 		} 
 		// step 4
 		assert(send_buffer_empty(s) && s->wb_size == 0);	//检查写缓存队列的数据是否都发送完了
-		sp_write(ss->event_fd, s->fd, s, false);			//修改套接字的监听事件为可读		
+		poll_write(slot_poller(ss, s), s->fd, s, false);			//修改套接字的监听事件为可读		
 
 		if (s->type == SOCKET_TYPE_HALFCLOSE) {				//如果套接字状态为半关闭状态则关闭套接字
 				force_close(ss, s, l, result);				//关闭套接字
@@ -888,7 +1181,7 @@ send_socket(struct socket_server *ss, struct request_send * request, struct sock
 				return -1;
 			}
 		}
-		sp_write(ss->event_fd, s->fd, s, true);		//修改该套接字fd监听的事件为可读可写
+		poll_write(slot_poller(ss, s), s->fd, s, true);		//修改该套接字fd监听的事件为可读可写
 	} else {	//缓存中有数据
 		if (s->protocol == PROTOCOL_TCP) {	//TCP协议
 			if (priority == PRIORITY_LOW) {	//添加到底优先级缓存队列
@@ -1015,13 +1308,14 @@ start_socket(struct socket_server *ss, struct request_start *request, struct soc
 	struct socket_lock l;
 	socket_lock_init(s, &l);	//锁l引用s中的锁
 	if (s->type == SOCKET_TYPE_PACCEPT || s->type == SOCKET_TYPE_PLISTEN) {	//如果套接字为没添加到epoll进行事件监听
-		if (sp_add(ss->event_fd, s->fd, s)) {	//添加套接字s->fd到epoll进行可读事件的监听，成功返回0，失败返回1
+		if (poll_add(slot_poller(ss, s), s->fd, s)) {	//添加套接字s->fd到epoll进行可读事件的监听，成功返回0，失败返回1
 			force_close(ss, s, &l, result);
 			result->data = strerror(errno);
 			return SOCKET_ERR;
 		}
 		//套接字状态改变SOCKET_TYPE_PACCEPT->SOCKET_TYPE_CONNECTED状态，否则SOCKET_TYPE_PLISTEN->SOCKET_TYPE_LISTEN状态
 		s->type = (s->type == SOCKET_TYPE_PACCEPT) ? SOCKET_TYPE_CONNECTED : SOCKET_TYPE_LISTEN;
+		poll_mode(slot_poller(ss, s), s);
 		s->opaque = request->opaque;
 		result->data = "start";
 		return SOCKET_OPEN;
@@ -1048,36 +1342,26 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));	//设置套接字的 TCP_NODELAY 选项，request->what为1禁止发送合并的Nagle算法
 }
 
-//读取读管道中指定长度的内容，例如读命令，以及读命令携带的数据
-static void
-block_readpipe(int pipefd, void *buffer, int sz) {
-	for (;;) {
-		int n = read(pipefd, buffer, sz);
-		if (n<0) {
-			if (errno == EINTR)	//中断
-				continue;
-			fprintf(stderr, "socket-server : read pipe error %s.\n",strerror(errno));
-			return;
-		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
-	}
-}
-
-//用于检查是否有命令，通过一个select监听读管道fd是否有可读事件，有则返回1，否则返回0，
+//用于检查命令队列中是否有命令，有则返回1，否则返回0
 static int
-has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
-
-	FD_SET(ss->recvctrl_fd, &ss->rfds);		//将管道读fd加入读描述符集合
+has_cmd(struct socket_poller *p) {
+	struct ctrl_queue *q = p->cq;
+	return q->slot[q->head % CTRL_QUEUE_SIZE].seq == q->head + 1;
+}
 
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);	//创建一个select，不阻塞
-	if (retval == 1) {
-		return 1;
+//网络线程被唤醒后清除通知，之后写入的命令会再次发出通知
+static void
+clear_ctrl_signal(struct socket_poller *p) {
+	uint8_t tmp[8];
+	for (;;) {
+		int n = read(p->recvctrl_fd, tmp, sizeof(tmp));
+		if (n < 0 && errno == EINTR)
+			continue;
+		break;
 	}
-	return 0;
+	ATOM_SYNC();
+	p->ctrl_signal = 0;
+	ATOM_SYNC();
 }
 
 //添加产生的套接字到分配的套接字信息结构中，并添加可读事件的监听，修改套接字的状态为 SOCKET_TYPE_CONNECTED
@@ -1130,18 +1414,32 @@ set_udp_address(struct socket_server *ss, struct request_setudp *request, struct
 	return -1;
 }
 
+//设置UDP套接字的批量接收模式
+static void
+set_udp_batch(struct socket_server *ss, struct request_udpbatch *request) {
+	int id = request->id;
+	struct socket *s = &ss->slot[HASH_ID(id)];
+	if (s->type == SOCKET_TYPE_INVALID || s->id !=id || s->protocol == PROTOCOL_TCP) {
+		return;
+	}
+	s->udpbatch = request->enable ? 1 : 0;
+}
+
 // return type
-//从读管道中取出相应的命令及附带的数据进行处理，result保存各个命令处理的结果信息，
+//从命令队列中取出一个命令及附带的数据进行处理，result保存各个命令处理的结果信息，
 static int
-ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
-	// the length of message is one byte, so 256+8 buffer size is enough.
+ctrl_cmd(struct socket_server *ss, struct socket_poller *p, struct socket_message *result) {
+	struct ctrl_queue *q = p->cq;
+	struct ctrl_slot *slot = &q->slot[q->head % CTRL_QUEUE_SIZE];
+	// the length of message is one byte, so 256 buffer size is enough.
 	uint8_t buffer[256];	//数据内容缓存
-	uint8_t header[2];		//命令缓存
-	block_readpipe(fd, header, sizeof(header));	//读取读管道中指定长度的命令内容
-	int type = header[0];	//命令的类型
-	int len = header[1];	//命令附带的数据长度
-	block_readpipe(fd, buffer, len);	//读取读管道中指定长度的数据内容
+	ATOM_SYNC();	// has_cmd saw seq, read the command written before it (acquire on weakly ordered cpus)
+	int type = slot->type;	//命令的类型
+	int len = slot->len;	//命令附带的数据长度
+	memcpy(buffer, slot->buffer, len);
+	ATOM_SYNC();
+	slot->seq = q->head + CTRL_QUEUE_SIZE;	//槽位可以被下一轮写入
+	++q->head;
 	// ctrl command only exist in local fd, so don't worry about endian.
 	switch (type) {
 	case 'S':	//开始添加套接字到epoll进行可读事件监听，改变套接字的状态为 SOCKET_TYPE_CONNECTED 或 SOCKET_TYPE_LISTEN
@@ -1176,6 +1474,9 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	case 'U':	//添加产生的套接字到分配的套接字信息结构中，并添加可读事件的监听，修改套接字的状态为 SOCKET_TYPE_CONNECTED
 		add_udp_socket(ss, (struct request_udp *)buffer);	//添加成功后不关联对端ip地址信息
 		return -1;
+	case 'M':	//设置UDP套接字是否批量接收数据
+		set_udp_batch(ss, (struct request_udpbatch *)buffer);
+		return -1;
 	default:
 		fprintf(stderr, "socket-server: Unknown ctrl %c.\n",type);
 		return -1;
@@ -1190,8 +1491,8 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;		//获取本次读取数据的最大长度
-	char * buffer = MALLOC(sz);	//分配缓存数据内存
-	int n = (int)read(s->fd, buffer, sz);	//读取数据
+	char * buffer;
+	int n = poll_read(slot_poller(ss, s), s->fd, &buffer, sz);	//读取数据
 	if (n<0) {			//如果读取不成功
 		FREE(buffer);	//释放内存
 		switch(errno) {	//出错原因
@@ -1252,13 +1553,107 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
-//接收UDP数据，数据存入ss->udpbuffer中，result->data返回数据+IP地址的信息
+//批量接收UDP数据，linux下用一次recvmmsg接收最多UDP_BATCH个数据包，返回接收到的数量
+static int
+recv_udp_batch(int fd, struct udp_batch *b) {
+	int i;
+#if defined(__linux__)
+	for (i=0;i<UDP_BATCH;i++) {
+		b->iov[i].iov_base = b->buffer[i];
+		b->iov[i].iov_len = MAX_UDP_PACKAGE;
+		memset(&b->msg[i].msg_hdr, 0, sizeof(b->msg[i].msg_hdr));
+		b->msg[i].msg_hdr.msg_name = &b->addr[i];
+		b->msg[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+		b->msg[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	int n = recvmmsg(fd, b->msg, UDP_BATCH, MSG_DONTWAIT, NULL);
+	for (i=0;i<n;i++) {
+		b->sz[i] = b->msg[i].msg_len;
+		b->addrsz[i] = b->msg[i].msg_hdr.msg_namelen;
+	}
+	return n;
+#else
+	(void)i;
+	b->addrsz[0] = sizeof(b->addr[0]);
+	int n = recvfrom(fd, b->buffer[0], MAX_UDP_PACKAGE, 0, &b->addr[0].s, &b->addrsz[0]);
+	if (n < 0) {
+		return n;
+	}
+	b->sz[0] = n;
+	return 1;
+#endif
+}
+
+//批量模式下接收UDP数据，把多个数据包合并成一块内存，result->data返回合并后的数据，result->ud为总长度
+//每个数据包的格式为：2字节的数据长度 + 对端地址（格式同udp_address）+ 数据
+//接收成功返回SOCKET_UDPBATCH，错误返回SOCKET_ERR，返回-1忽略
+static int
+forward_message_udpbatch(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	struct socket_poller *p = slot_poller(ss, s);
+	if (p->udpbatch == NULL) {
+		p->udpbatch = MALLOC(sizeof(struct udp_batch));
+	}
+	struct udp_batch *b = p->udpbatch;
+	int n = recv_udp_batch(s->fd, b);
+	if (n<0) {			//错误处理
+		switch(errno) {
+		case EINTR:
+		case AGAIN_WOULDBLOCK:
+			break;
+		default:
+			// close when error
+			force_close(ss, s, l, result);
+			result->data = strerror(errno);
+			return SOCKET_ERR;
+		}
+		return -1;
+	}
+	int addrsz = (s->protocol == PROTOCOL_UDP) ? 1+2+4 : 1+2+16;
+	size_t total = 0;
+	int i;
+	for (i=0;i<n;i++) {
+		if ((b->addrsz[i] == sizeof(b->addr[i].v4)) == (s->protocol == PROTOCOL_UDP)) {	//协议不匹配的数据包忽略
+			total += 2 + addrsz + b->sz[i];
+		} else {
+			b->sz[i] = -1;
+		}
+	}
+	if (total == 0) {
+		return -1;
+	}
+	uint8_t * data = MALLOC(total);
+	uint8_t * ptr = data;
+	for (i=0;i<n;i++) {
+		if (b->sz[i] < 0)
+			continue;
+		uint16_t sz = (uint16_t)b->sz[i];
+		memcpy(ptr, &sz, sizeof(sz));
+		ptr += sizeof(sz);
+		ptr += gen_udp_address(s->protocol, &b->addr[i], ptr);
+		memcpy(ptr, b->buffer[i], sz);
+		ptr += sz;
+	}
+
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = (int)total;
+	result->data = (char *)data;
+
+	return SOCKET_UDPBATCH;
+}
+
+//接收UDP数据，数据存入所属网络线程的udpbuffer中，result->data返回数据+IP地址的信息
 //接收成功返回SOCKET_UDP，错误返回SOCKET_ERR，返回-1忽略
 static int
 forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	if (s->udpbatch) {
+		return forward_message_udpbatch(ss, s, l, result);
+	}
 	union sockaddr_all sa;
 	socklen_t slen = sizeof(sa);
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);	//接收数据
+	uint8_t * udpbuffer = slot_poller(ss, s)->udpbuffer;
+	int n = recvfrom(s->fd, udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);	//接收数据
 	if (n<0) {			//错误处理
 		switch(errno) {
 		case EINTR:
@@ -1284,7 +1679,7 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 		data = MALLOC(n + 1 + 2 + 16);
 		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
 	}
-	memcpy(data, ss->udpbuffer, n);
+	memcpy(data, udpbuffer, n);
 
 	result->opaque = s->opaque;
 	result->id = s->id;
@@ -1310,18 +1705,20 @@ report_connect(struct socket_server *ss, struct socket *s, struct socket_lock *l
 		return SOCKET_ERR;
 	} else {
 		s->type = SOCKET_TYPE_CONNECTED;	//改变套接字的状态为 SOCKET_TYPE_CONNECTING -> SOCKET_TYPE_CONNECTED
+		poll_mode(slot_poller(ss, s), s);
 		result->opaque = s->opaque;
 		result->id = s->id;
 		result->ud = 0;
 		if (nomore_send_data(s)) {			//检查写缓存中有没有数据发送
-			sp_write(ss->event_fd, s->fd, s, false);	//没有数据，将套接字的事件监听改为监听可读事件
+			poll_write(slot_poller(ss, s), s->fd, s, false);	//没有数据，将套接字的事件监听改为监听可读事件
 		}
 		union sockaddr_all u;
 		socklen_t slen = sizeof(u);
 		if (getpeername(s->fd, &u.s, &slen) == 0) {	//获取与该套接字相连的IP地址
 			void * sin_addr = (u.s.sa_family == AF_INET) ? (void*)&u.v4.sin_addr : (void *)&u.v6.sin6_addr;	//根据不同的协议获得地址
-			if (inet_ntop(u.s.sa_family, sin_addr, ss->buffer, sizeof(ss->buffer))) {	//保存套接字的对端ip地址到ss->buffer
-				result->data = ss->buffer;
+			struct socket_poller *p = slot_poller(ss, s);
+			if (inet_ntop(u.s.sa_family, sin_addr, p->buffer, sizeof(p->buffer))) {	//保存套接字的对端ip地址到p->buffer
+				result->data = p->buffer;
 				return SOCKET_OPEN;
 			}
 		}
@@ -1339,7 +1736,7 @@ static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);	//等待客户端的连接请求
+	int client_fd = poll_accept(slot_poller(ss, s), s->fd, &u.s, &len);	//等待客户端的连接请求
 	if (client_fd < 0) {						//发生错误
 		if (errno == EMFILE || errno == ENFILE) {	//表示打开的描述符超出限制
 			result->opaque = s->opaque;
@@ -1374,8 +1771,9 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	int sin_port = ntohs((u.s.sa_family == AF_INET) ? u.v4.sin_port : u.v6.sin6_port);
 	char tmp[INET6_ADDRSTRLEN];
 	if (inet_ntop(u.s.sa_family, sin_addr, tmp, sizeof(tmp))) {
-		snprintf(ss->buffer, sizeof(ss->buffer), "%s:%d", tmp, sin_port);	//保存客户端的ip地址和端口号
-		result->data = ss->buffer;
+		struct socket_poller *p = slot_poller(ss, s);	//监听套接字所在的网络线程
+		snprintf(p->buffer, sizeof(p->buffer), "%s:%d", tmp, sin_port);	//保存客户端的ip地址和端口号
+		result->data = p->buffer;
 	}
 
 	return 1;
@@ -1383,12 +1781,12 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 
 //如果处理完命令后的返回值为关闭套接字或错误，则将该套接字相关的监听事件清除
 static inline void 
-clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
+clear_closed_event(struct socket_poller *p, struct socket_message * result, int type) {
 	if (type == SOCKET_CLOSE || type == SOCKET_ERR) {	//如果处理命令后的返回值为SOCKET_CLOSE或SOCKET_ERR
 		int id = result->id;
 		int i;
-		for (i=ss->event_index; i<ss->event_n; i++) {
-			struct event *e = &ss->ev[i];
+		for (i=p->event_index; i<p->event_n; i++) {
+			struct event *e = &p->ev[i];
 			struct socket *s = e->s;
 			if (s) {
 				if (s->type == SOCKET_TYPE_INVALID && s->id == id) {
@@ -1406,38 +1804,47 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 //more为1表示上次的事件还没处理完，0表示上次的事件都处理完了
 int 
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
+	return socket_server_poll_thread(ss, 0, result, more);
+}
+
+//第thread个网络线程的主循环，只处理属于该线程的命令和套接字
+int 
+socket_server_poll_thread(struct socket_server *ss, int thread, struct socket_message * result, int * more) {
+	struct socket_poller *p = &ss->poller[thread];
 	for (;;) {
-		if (ss->checkctrl) {	//判断是否需要检查读管道中的命令，默认需要
-			if (has_cmd(ss)) {	//检查读管道上是否有命令可读取，有则返回1，否则返回0
-				int type = ctrl_cmd(ss, result);	//从读管道上读取相应的命令，并对其数据进行处理，返回相应的处理结果
+		if (p->checkctrl) {	//判断是否需要检查读管道中的命令，默认需要
+			if (has_cmd(p)) {	//检查读管道上是否有命令可读取，有则返回1，否则返回0
+				int type = ctrl_cmd(ss, p, result);	//从读管道上读取相应的命令，并对其数据进行处理，返回相应的处理结果
 				if (type != -1) {
-					clear_closed_event(ss, result, type);	//清除掉该套接字相关的监听事件
+					clear_closed_event(p, result, type);	//清除掉该套接字相关的监听事件
 					return type;
 				} else 		//type=-1说明是一个过渡状态
 					continue;
 			} else {
-				ss->checkctrl = 0;
+				p->checkctrl = 0;
 			}
 		}
-		if (ss->event_index == ss->event_n) {
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);	//等待epoll上监听的事件触发，阻塞，返回触发事件的数量
-			ss->checkctrl = 1;
+		if (p->event_index == p->event_n) {
+			p->event_n = poll_wait(p, p->ev, MAX_EVENT);	//等待epoll上监听的事件触发，阻塞，返回触发事件的数量
+			p->checkctrl = 1;
 			if (more) {
 				*more = 0;			//标记上一次的事件都处理完了
 			}
-			ss->event_index = 0;
-			if (ss->event_n <= 0) {
-				ss->event_n = 0;
+			p->event_index = 0;
+			if (p->event_n <= 0) {
+				p->event_n = 0;
 				if (errno == EINTR) {	//判断是否是中断
 					continue;
 				}
 				return -1;
 			}
 		}
-		struct event *e = &ss->ev[ss->event_index++];	//从监听到的事件中取出一个事件
+		struct event *e = &p->ev[p->event_index++];	//从监听到的事件中取出一个事件
 		struct socket *s = e->s;	//取出事件附带的socket信息
-		if (s == NULL) {			//开始时发送的是管道消息
-			// dispatch pipe message at beginning
+		if (s == NULL) {			//有新的命令写入命令队列
+			// commands are dispatched at the beginning of the loop
+			clear_ctrl_signal(p);
+			p->checkctrl = 1;
 			continue;
 		}
 		struct socket_lock l;
@@ -1465,16 +1872,16 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 					type = forward_message_tcp(ss, s, &l, result);	//读取数据
 				} else {							//如果是UDP通信
 					type = forward_message_udp(ss, s, &l, result);	//接收UDP数据
-					if (type == SOCKET_UDP) {		//如果接收到UDP数据
+					if (type == SOCKET_UDP || type == SOCKET_UDPBATCH) {		//如果接收到UDP数据
 						// try read again
-						--ss->event_index;			//下次还会尝试去读取一次数据
-						return SOCKET_UDP;
+						--p->event_index;			//下次还会尝试去读取一次数据
+						return type;
 					}
 				}
 				if (e->write && type != SOCKET_CLOSE && type != SOCKET_ERR) {
 					// Try to dispatch write message next step if write flag set.
 					e->read = false;
-					--ss->event_index;				//下次会再尝试去写数据
+					--p->event_index;				//下次会再尝试去写数据
 				}
 				if (type == -1)
 					break;				
@@ -1508,21 +1915,46 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
-//将套接字的命令写入到管道中去, 通过 recvctrl_fd 文件描述符可以从管道中读取数据并执行相应的命令
+//将套接字的命令写入到id所属网络线程的命令队列中去，网络线程可能在等待epoll时才写eventfd唤醒它
+//队列满时等待网络线程取出命令，和写满的管道一样
 static void
-send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;		//请求的类型
-	request->header[7] = (uint8_t)len;		//不包含类型的大小，请求内容的长度
+send_request(struct socket_server *ss, int id, struct request_package *request, char type, int len) {
+	struct socket_poller *p = id_poller(ss, id);
+	struct ctrl_queue *q = p->cq;
+	struct ctrl_slot *slot;
+	unsigned pos = q->tail;
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, &request->header[6], len+2);	//写管道，然后通过读管道recvctrl_fd进行读取
-		if (n<0) {	//判断是否写成功
-			if (errno != EINTR) {	//判断不成功是否是中断的原因
+		slot = &q->slot[pos % CTRL_QUEUE_SIZE];
+		int diff = (int)(slot->seq - pos);
+		if (diff == 0) {
+			if (ATOM_CAS(&q->tail, pos, pos + 1))
+				break;
+		} else if (diff < 0) {	//队列满了
+			sched_yield();
+		}
+		pos = q->tail;
+	}
+	slot->type = (uint8_t)type;		//请求的类型
+	slot->len = (uint8_t)len;		//请求内容的长度
+	memcpy(slot->buffer, request->u.buffer, len);
+	ATOM_SYNC();
+	slot->seq = pos + 1;			//命令已经写好
+	ATOM_SYNC();
+	if (p->ctrl_signal == 0 && ATOM_CAS(&p->ctrl_signal, 0, 1)) {
+#if defined(__linux__)
+		uint64_t one = 1;
+#else
+		uint8_t one = 1;
+#endif
+		for (;;) {
+			ssize_t n = write(p->sendctrl_fd, &one, sizeof(one));
+			if (n<0) {	//判断是否写成功
+				if (errno == EINTR)	//判断不成功是否是中断的原因
+					continue;
 				fprintf(stderr, "socket-server : send ctrl command error %s.\n", strerror(errno));
 			}
-			continue;
+			return;
 		}
-		assert(n == len+2);
-		return;
 	}
 }
 
@@ -1554,7 +1986,7 @@ socket_server_connect(struct socket_server *ss, uintptr_t opaque, const char * a
 	int len = open_request(ss, &request, opaque, addr, port);	//生成一个TCP连接请求的包的信息，包括分配存储套接字信息
 	if (len < 0)
 		return -1;
-	send_request(ss, &request, 'O', sizeof(request.u.open) + len);	//将套接字的命令‘O’写入到管道中去
+	send_request(ss, request.u.open.id, &request, 'O', sizeof(request.u.open) + len);	//将套接字的命令‘O’写入到管道中去
 	return request.u.open.id;	//返回存储套接字信息的id
 }
 
@@ -1609,7 +2041,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 			s->dw_size = sz;
 			s->dw_offset = n;
 
-			sp_write(ss->event_fd, s->fd, s, true);	//修改套接字的监听事件为可读可写
+			poll_write(slot_poller(ss, s), s->fd, s, true);	//修改套接字的监听事件为可读可写
 
 			socket_unlock(&l);	//释放锁
 			return 0;
@@ -1622,7 +2054,7 @@ socket_server_send(struct socket_server *ss, int id, const void * buffer, int sz
 	request.u.send.sz = sz;
 	request.u.send.buffer = (char *)buffer;
 
-	send_request(ss, &request, 'D', sizeof(request.u.send));	//将套接字的命令‘D’写入到管道中去
+	send_request(ss, id, &request, 'D', sizeof(request.u.send));	//将套接字的命令‘D’写入到管道中去
 	return 0;
 }
 
@@ -1641,7 +2073,7 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 	request.u.send.sz = sz;			//低优先级数据的长度
 	request.u.send.buffer = (char *)buffer;	//低优先级数据内容
 
-	send_request(ss, &request, 'P', sizeof(request.u.send));	////将套接字的命令‘P’写入到管道中去
+	send_request(ss, id, &request, 'P', sizeof(request.u.send));	////将套接字的命令‘P’写入到管道中去
 	return 0;
 }
 
@@ -1650,7 +2082,10 @@ socket_server_send_lowpriority(struct socket_server *ss, int id, const void * bu
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
-	send_request(ss, &request, 'X', 0);
+	int i;
+	for (i=0;i<ss->poller_n;i++) {	//每个网络线程都会收到 SOCKET_EXIT
+		send_request(ss, i, &request, 'X', 0);
+	}
 }
 
 //向写管道中发起一个关闭某个指定套接字的命令'K'，通过id可以定位的套接字的信息
@@ -1660,7 +2095,7 @@ socket_server_close(struct socket_server *ss, uintptr_t opaque, int id) {
 	request.u.close.id = id;		//定位存储套接字信息的id
 	request.u.close.shutdown = 0;	//
 	request.u.close.opaque = opaque;//定位服务的handle
-	send_request(ss, &request, 'K', sizeof(request.u.close));	//将套接字的命令‘K’写入到管道中去
+	send_request(ss, id, &request, 'K', sizeof(request.u.close));	//将套接字的命令‘K’写入到管道中去
 }
 
 //发送命令'K'，强制关闭套接字
@@ -1670,7 +2105,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 	request.u.close.id = id;
 	request.u.close.shutdown = 1;
 	request.u.close.opaque = opaque;
-	send_request(ss, &request, 'K', sizeof(request.u.close));
+	send_request(ss, id, &request, 'K', sizeof(request.u.close));
 }
 
 // return -1 means failed
@@ -1755,7 +2190,7 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	request.u.listen.opaque = opaque;	//定位服务的handle
 	request.u.listen.id = id;			//定位套接字信息的id
 	request.u.listen.fd = fd;			//套接字
-	send_request(ss, &request, 'L', sizeof(request.u.listen));	//将套接字的命令‘L’写入到管道中去
+	send_request(ss, id, &request, 'L', sizeof(request.u.listen));	//将套接字的命令‘L’写入到管道中去
 	return id;
 }
 
@@ -1769,7 +2204,7 @@ socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
 	request.u.bind.opaque = opaque;	//定位服务的handle
 	request.u.bind.id = id;			//定位套接字信息的id
 	request.u.bind.fd = fd;			//套接字
-	send_request(ss, &request, 'B', sizeof(request.u.bind));	//将套接字的命令‘B’写入到管道中去
+	send_request(ss, id, &request, 'B', sizeof(request.u.bind));	//将套接字的命令‘B’写入到管道中去
 	return id;
 }
 
@@ -1779,7 +2214,7 @@ socket_server_start(struct socket_server *ss, uintptr_t opaque, int id) {
 	struct request_package request;
 	request.u.start.id = id;			//定位套接字信息的id
 	request.u.start.opaque = opaque;	//定位服务的handle
-	send_request(ss, &request, 'S', sizeof(request.u.start));	//发送命令'S'，
+	send_request(ss, id, &request, 'S', sizeof(request.u.start));	//发送命令'S'，
 }
 
 //发送指令'T'，请求设置套接字的选项，选项的层次在 IPPROTO_TCP 上 , 设置的键和值都是 int 类型的, 
@@ -1790,7 +2225,16 @@ socket_server_nodelay(struct socket_server *ss, int id) {
 	request.u.setopt.id = id;
 	request.u.setopt.what = TCP_NODELAY;
 	request.u.setopt.value = 1;
-	send_request(ss, &request, 'T', sizeof(request.u.setopt));
+	send_request(ss, id, &request, 'T', sizeof(request.u.setopt));
+}
+
+//发送指令'M'，设置UDP套接字是否批量接收数据，开启后收到的是SOCKET_UDPBATCH
+void
+socket_server_udp_batch(struct socket_server *ss, int id, int enable) {
+	struct request_package request;
+	request.u.udpbatch.id = id;
+	request.u.udpbatch.enable = enable;
+	send_request(ss, id, &request, 'M', sizeof(request.u.udpbatch));
 }
 
 void 
@@ -1833,7 +2277,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	request.u.udp.opaque = opaque;
 	request.u.udp.family = family;
 
-	send_request(ss, &request, 'U', sizeof(request.u.udp));	//发送命令'U'，添加UDP套接字信息
+	send_request(ss, id, &request, 'U', sizeof(request.u.udp));	//发送命令'U'，添加UDP套接字信息
 	return id;
 }
 
@@ -1891,7 +2335,7 @@ socket_server_udp_send(struct socket_server *ss, int id, const struct socket_udp
 
 	memcpy(request.u.send_udp.address, udp_address, addrsz);
 
-	send_request(ss, &request, 'A', sizeof(request.u.send_udp.send)+addrsz);	//通过命令‘A’，将数据写入缓存中
+	send_request(ss, id, &request, 'A', sizeof(request.u.send_udp.send)+addrsz);	//通过命令‘A’，将数据写入缓存中
 	return 0;
 }
 
@@ -1944,7 +2388,7 @@ socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, i
 	freeaddrinfo( ai_list );
 
 	//发送命令'C'，将指定的套接字信息关联ip地址
-	send_request(ss, &request, 'C', sizeof(request.u.set_udp) - sizeof(request.u.set_udp.address) +addrsz);
+	send_request(ss, id, &request, 'C', sizeof(request.u.set_udp) - sizeof(request.u.set_udp.address) +addrsz);
 
 	return 0;
 }
@@ -12,6 +12,7 @@
 #define SOCKET_EXIT 5			//整个套接字服务退出
 #define SOCKET_UDP 6			//套接字已接收UDP数据
 #define SOCKET_WARNING 7		//写缓存超出阈值
+#define SOCKET_UDPBATCH 8		//套接字已接收多个UDP数据包，见socket_server_udp_batch
 
 struct socket_server;
 
@@ -26,6 +27,13 @@ struct socket_server * socket_server_create();
 void socket_server_release(struct socket_server *);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
 
+// Create a socket server served by n threads, each thread calls socket_server_poll_thread with its own index.
+// A socket belongs to the thread (id % MAX_SOCKET) % n, the other apis are thread safe as before.
+// If uring is not 0, the threads use io_uring instead of epoll (tcp reads and accepts are completed by io_uring),
+// and fall back to epoll when it's unavailable.
+struct socket_server * socket_server_create_thread(int n, int uring);
+int socket_server_poll_thread(struct socket_server *, int thread, struct socket_message *result, int *more);
+
 void socket_server_exit(struct socket_server *);
 void socket_server_close(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_shutdown(struct socket_server *, uintptr_t opaque, int id);
@@ -55,6 +63,10 @@ int socket_server_udp_connect(struct socket_server *, int id, const char * addr,
 int socket_server_udp_send(struct socket_server *, int id, const struct socket_udp_address *, const void *buffer, int sz);
 // extract the address of the message, struct socket_message * should be SOCKET_UDP
 const struct socket_udp_address * socket_server_udp_address(struct socket_server *, struct socket_message *, int *addrsz);
+// In batch mode the socket reads up to 16 datagrams at once (recvmmsg on linux) and reports them as one SOCKET_UDPBATCH.
+// The data is a sequence of datagrams, each one is a uint16_t size (native endian), the address (the same format as
+// socket_udp_address, its size depends on the protocol) and the payload. ud is the size of the whole data.
+void socket_server_udp_batch(struct socket_server *, int id, int enable);
 
 struct socket_object_interface {
 	void * (*buffer)(void *);
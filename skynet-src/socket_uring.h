@@ -0,0 +1,684 @@
+#ifndef poll_socket_uring_h
+#define poll_socket_uring_h
+
+// io_uring backend of the socket poll. Every operation is one shot, the operations completed are
+// re-armed at the next su_wait, so they are all submitted by the same io_uring_enter that waits.
+// A registered fd starts in poll mode (IORING_OP_POLL_ADD on POLLIN, like socket_epoll.h).
+// su_mode switches a connected TCP socket to IORING_OP_RECV into the provided buffers,
+// and a listen socket to IORING_OP_ACCEPT; the caller takes the results by su_read and su_accept
+// instead of calling read and accept. Writing is always readiness based, POLLOUT is polled by its own
+// operation, which is simply dropped when it fires after the write event has been disabled.
+// su_create returns NULL when io_uring is unavailable, the caller should use epoll instead.
+
+#include "skynet_malloc.h"
+#include "spinlock.h"
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#define SU_POLL 0		//可读事件，由调用者自己读取
+#define SU_RECV 1		//由io_uring读取数据到提供的缓存中
+#define SU_ACCEPT 2		//由io_uring接受连接
+
+struct uring_poll;
+
+static struct uring_poll * su_create(int entries);
+static void su_release(struct uring_poll *u);
+static int su_add(struct uring_poll *u, int sock, void *ud);
+static void su_del(struct uring_poll *u, int sock);
+static void su_write(struct uring_poll *u, int sock, void *ud, bool enable);
+static void su_mode(struct uring_poll *u, int sock, int mode);
+static int su_wait(struct uring_poll *u, struct event *e, int max);
+// return 0 if there is no completed read of sock, otherwise set *buffer and *n as read() does (errno when *n < 0)
+static int su_read(struct uring_poll *u, int sock, void **buffer, int *n);
+// return 0 if there is no completed accept of sock, otherwise set *fd as accept() does
+static int su_accept(struct uring_poll *u, int sock, struct sockaddr *addr, socklen_t *len, int *fd);
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SKYNET_URING
+#endif
+#endif
+
+#ifdef SKYNET_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define URING_CQ_ENTRIES 65536
+#define URING_BUFFER_SIZE 16384		//每个提供给内核的读缓存的大小
+#define URING_BUFFER_COUNT 256		//提供给内核的读缓存的数量
+#define URING_BUFFER_GROUP 0
+
+// the low bits of user_data, the operation of the item
+#define URING_OP_POLLIN 1
+#define URING_OP_POLLOUT 2
+#define URING_OP_RECV 3
+#define URING_OP_ACCEPT 4
+#define URING_OP_MASK 7
+
+#define URING_ARM_READ 1			//读的操作(POLLIN, RECV或ACCEPT)还没有完成
+#define URING_ARM_WRITE 2			//POLLOUT还没有完成
+
+struct uring_item {			//一个注册的fd
+	int fd;
+	void *ud;				//事件附带的数据
+	uint8_t mode;			//SU_POLL, SU_RECV或SU_ACCEPT
+	uint8_t write;			//是否监听可写事件
+	uint8_t armed;			//提交了还没有完成的操作，URING_ARM_READ和URING_ARM_WRITE
+	uint8_t cancel;			//已经提交了取消请求的操作
+	uint8_t pending;		//在等待提交操作的列表中
+	uint8_t dead;			//已经被su_del删除，没有操作引用时释放
+	uint8_t ready;			//有完成的recv或accept结果还没有被取走
+	int result;				//recv或accept的结果
+	int bid;				//recv结果所在的缓存的序号
+	socklen_t addrlen;		//accept的对端地址
+	struct sockaddr_storage addr;
+	struct uring_item *prev;	//所有的item组成的链表，用于释放
+	struct uring_item *next;
+};
+
+struct uring_poll {
+	int fd;
+	struct spinlock lock;	//su_write可能在工作线程中调用，提交队列和fd的状态都要加锁
+	pthread_t owner;		//调用su_wait的网络线程
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+	struct uring_item **item;	//以fd为索引
+	int item_cap;
+	struct uring_item *all;		//所有的item，包括已经删除但还有操作的
+	struct uring_item **rearm;	//需要提交操作的item
+	int rearm_n;
+	int rearm_cap;
+	char *buffer[URING_BUFFER_COUNT];	//提供给内核的读缓存，以序号为索引
+	int refill[URING_BUFFER_COUNT];		//需要重新提供给内核的缓存的序号
+	int refill_n;
+};
+
+static int
+su_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static unsigned
+su_unsubmitted(struct uring_poll *u) {
+	return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+//提交队列中所有还没有提交的请求，不等待完成，失败返回-1（例如完成队列溢出时的EBUSY）
+static int
+su_submit(struct uring_poll *u) {
+	unsigned n = su_unsubmitted(u);
+	while (n > 0) {
+		int r = su_enter(u->fd, n, 0, 0);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			return -1;
+		n = su_unsubmitted(u);
+	}
+	return 0;
+}
+
+//取得一个空的提交队列项，队列满时先提交，仍然没有空间时返回NULL，由调用者稍后重试
+static struct io_uring_sqe *
+su_sqe(struct uring_poll *u) {
+	if (su_unsubmitted(u) >= u->sq_entries) {
+		su_submit(u);
+		if (su_unsubmitted(u) >= u->sq_entries) {
+			return NULL;
+		}
+	}
+	unsigned tail = *u->sq_tail;
+	unsigned index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[index] = index;
+	return sqe;
+}
+
+static void
+su_push(struct uring_poll *u) {
+	__atomic_store_n(u->sq_tail, *u->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+su_userdata(struct uring_item *item, int op) {
+	return (uint64_t)(uintptr_t)item | op;
+}
+
+//提交item的读操作，由item的模式决定是POLLIN，RECV还是ACCEPT
+static int
+su_arm_read(struct uring_poll *u, struct uring_item *item) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->fd = item->fd;
+	switch (item->mode) {
+	case SU_RECV:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->len = URING_BUFFER_SIZE;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = URING_BUFFER_GROUP;
+		sqe->user_data = su_userdata(item, URING_OP_RECV);
+		break;
+	case SU_ACCEPT:
+		item->addrlen = sizeof(item->addr);
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->addr = (uint64_t)(uintptr_t)&item->addr;
+		sqe->addr2 = (uint64_t)(uintptr_t)&item->addrlen;
+		sqe->user_data = su_userdata(item, URING_OP_ACCEPT);
+		break;
+	default:
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = su_userdata(item, URING_OP_POLLIN);
+		break;
+	}
+	su_push(u);
+	item->armed |= URING_ARM_READ;
+	return 0;
+}
+
+static int
+su_arm_write(struct uring_poll *u, struct uring_item *item) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = item->fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = su_userdata(item, URING_OP_POLLOUT);
+	su_push(u);
+	item->armed |= URING_ARM_WRITE;
+	return 0;
+}
+
+//取消item上还没有完成的读操作或写操作，取消请求本身的完成事件user_data为0
+static int
+su_cancel(struct uring_poll *u, struct uring_item *item, int arm) {
+	if (!(item->armed & arm) || (item->cancel & arm)) {
+		return 0;
+	}
+	struct io_uring_sqe *sqe = su_sqe(u);
+	if (sqe == NULL) {
+		return -1;
+	}
+	int op = (arm == URING_ARM_WRITE) ? URING_OP_POLLOUT :
+		(item->mode == SU_RECV ? URING_OP_RECV : (item->mode == SU_ACCEPT ? URING_OP_ACCEPT : URING_OP_POLLIN));
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = su_userdata(item, op);
+	sqe->user_data = 0;
+	su_push(u);
+	item->cancel |= arm;
+	return 0;
+}
+
+//把一个读缓存提供给内核
+static int
+su_provide(struct uring_poll *u, int bid) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = 1;	// number of buffers
+	sqe->addr = (uint64_t)(uintptr_t)u->buffer[bid];
+	sqe->len = URING_BUFFER_SIZE;
+	sqe->off = bid;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = 0;
+	su_push(u);
+	return 0;
+}
+
+static void
+su_pending(struct uring_poll *u, struct uring_item *item) {
+	if (item->pending) {
+		return;
+	}
+	if (u->rearm_n >= u->rearm_cap) {
+		int cap = u->rearm_cap * 2;
+		struct uring_item **rearm = skynet_malloc(cap * sizeof(*rearm));
+		memcpy(rearm, u->rearm, u->rearm_n * sizeof(*rearm));
+		skynet_free(u->rearm);
+		u->rearm = rearm;
+		u->rearm_cap = cap;
+	}
+	u->rearm[u->rearm_n++] = item;
+	item->pending = 1;
+}
+
+//释放item，还没有取走的recv缓存还给内核，还没有取走的连接关闭
+static void
+su_free(struct uring_poll *u, struct uring_item *item) {
+	if (item->ready) {
+		if (item->mode == SU_RECV && item->result > 0) {
+			u->refill[u->refill_n++] = item->bid;
+		} else if (item->mode == SU_ACCEPT && item->result >= 0) {
+			close(item->result);
+		}
+	}
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		u->all = item->next;
+	if (item->next)
+		item->next->prev = item->prev;
+	skynet_free(item);
+}
+
+static struct uring_poll *
+su_create(int entries) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (!(p.features & IORING_FEAT_NODROP)) {	//完成队列满时不能丢弃完成事件
+		close(fd);
+		return NULL;
+	}
+	struct uring_poll *u = skynet_malloc(sizeof(*u));
+	memset(u, 0, sizeof(*u));
+	u->fd = fd;
+	u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+		if (u->sq_ring != MAP_FAILED)
+			munmap(u->sq_ring, u->sq_ring_sz);
+		if (u->cq_ring != MAP_FAILED)
+			munmap(u->cq_ring, u->cq_ring_sz);
+		if (u->sqes != MAP_FAILED)
+			munmap(u->sqes, u->sqes_sz);
+		close(fd);
+		skynet_free(u);
+		return NULL;
+	}
+	char *sq = u->sq_ring;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->sq_entries = p.sq_entries;
+	char *cq = u->cq_ring;
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	spinlock_init(&u->lock);
+	u->owner = pthread_self();
+	u->item_cap = 1024;
+	u->item = skynet_malloc(u->item_cap * sizeof(*u->item));
+	memset(u->item, 0, u->item_cap * sizeof(*u->item));
+	u->rearm_cap = 64;
+	u->rearm = skynet_malloc(u->rearm_cap * sizeof(*u->rearm));
+	int i;
+	for (i=0;i<URING_BUFFER_COUNT;i++) {	//第一次su_wait时提供给内核
+		u->buffer[i] = skynet_malloc(URING_BUFFER_SIZE);
+		u->refill[i] = i;
+	}
+	u->refill_n = URING_BUFFER_COUNT;
+	return u;
+}
+
+//先关闭io_uring，内核会取消所有的操作，之后所有的item和缓存都可以直接释放
+static void
+su_release(struct uring_poll *u) {
+	close(u->fd);
+	munmap(u->sq_ring, u->sq_ring_sz);
+	munmap(u->cq_ring, u->cq_ring_sz);
+	munmap(u->sqes, u->sqes_sz);
+	while (u->all) {
+		su_free(u, u->all);
+	}
+	int i;
+	for (i=0;i<URING_BUFFER_COUNT;i++) {
+		skynet_free(u->buffer[i]);
+	}
+	skynet_free(u->item);
+	skynet_free(u->rearm);
+	spinlock_destroy(&u->lock);
+	skynet_free(u);
+}
+
+//添加对sock描述符的可读事件的监听，操作在下一次su_wait时提交
+static int
+su_add(struct uring_poll *u, int sock, void *ud) {
+	spinlock_lock(&u->lock);
+	if (sock >= u->item_cap) {
+		int cap = u->item_cap;
+		while (cap <= sock)
+			cap *= 2;
+		struct uring_item **item = skynet_malloc(cap * sizeof(*item));
+		memset(item, 0, cap * sizeof(*item));
+		memcpy(item, u->item, u->item_cap * sizeof(*item));
+		skynet_free(u->item);
+		u->item = item;
+		u->item_cap = cap;
+	}
+	if (u->item[sock]) {
+		spinlock_unlock(&u->lock);
+		return 1;
+	}
+	struct uring_item *item = skynet_malloc(sizeof(*item));
+	memset(item, 0, sizeof(*item));
+	item->fd = sock;
+	item->ud = ud;
+	item->mode = SU_POLL;
+	item->next = u->all;
+	if (u->all)
+		u->all->prev = item;
+	u->all = item;
+	u->item[sock] = item;
+	su_pending(u, item);
+	spinlock_unlock(&u->lock);
+	return 0;
+}
+
+//删除对sock描述符的事件的监听，还没有完成的操作在下一次su_wait时取消，之后释放item
+static void
+su_del(struct uring_poll *u, int sock) {
+	spinlock_lock(&u->lock);
+	struct uring_item *item = sock < u->item_cap ? u->item[sock] : NULL;
+	if (item) {
+		u->item[sock] = NULL;
+		item->dead = 1;
+		if (item->armed || item->pending) {
+			su_pending(u, item);
+		} else {
+			su_free(u, item);
+		}
+	}
+	spinlock_unlock(&u->lock);
+}
+
+//修改sock描述符是否监听可写事件，关闭时不需要取消操作，POLLOUT完成时丢弃即可
+//在工作线程中打开时立即提交，网络线程中打开时随下一次su_wait提交
+static void
+su_write(struct uring_poll *u, int sock, void *ud, bool enable) {
+	spinlock_lock(&u->lock);
+	struct uring_item *item = sock < u->item_cap ? u->item[sock] : NULL;
+	if (item) {
+		item->ud = ud;
+		item->write = enable;
+		if (enable && !(item->armed & URING_ARM_WRITE)) {
+			if (pthread_equal(pthread_self(), u->owner) || su_arm_write(u, item) || su_submit(u)) {
+				su_pending(u, item);
+			}
+		}
+	}
+	spinlock_unlock(&u->lock);
+}
+
+//修改sock描述符的读操作，只在网络线程中调用，已经提交的读操作取消后用新的模式重新提交
+static void
+su_mode(struct uring_poll *u, int sock, int mode) {
+	spinlock_lock(&u->lock);
+	struct uring_item *item = sock < u->item_cap ? u->item[sock] : NULL;
+	if (item && item->mode != mode && !item->ready) {
+		su_cancel(u, item, URING_ARM_READ);
+		item->mode = mode;
+		su_pending(u, item);
+	}
+	spinlock_unlock(&u->lock);
+}
+
+//提交等待中的item的操作和需要重新提供的读缓存，还有没被取走的结果时再次报告可读事件
+static int
+su_flush(struct uring_poll *u, struct event *e, int max) {
+	int n = 0;
+	while (u->refill_n > 0) {
+		if (su_provide(u, u->refill[u->refill_n - 1]))
+			break;
+		--u->refill_n;
+	}
+	int i, j = 0;
+	for (i=0;i<u->rearm_n;i++) {
+		struct uring_item *item = u->rearm[i];
+		int ok;
+		if (item->dead) {
+			if (item->armed == 0) {
+				su_free(u, item);
+				continue;
+			}
+			ok = su_cancel(u, item, URING_ARM_READ) == 0 && su_cancel(u, item, URING_ARM_WRITE) == 0;
+			if (ok)	//等待被取消的操作完成后释放
+				item->pending = 0;
+			else
+				u->rearm[j++] = item;
+			continue;
+		}
+		ok = 1;
+		if (item->ready) {	//结果还没有被取走
+			if (n < max) {
+				e[n].s = item->ud;
+				e[n].read = true;
+				e[n].write = false;
+				e[n].error = false;
+				++n;
+			}
+			ok = 0;
+		} else if (!(item->armed & URING_ARM_READ)) {
+			ok = su_arm_read(u, item) == 0;
+		}
+		if (ok && item->write && !(item->armed & URING_ARM_WRITE)) {
+			ok = su_arm_write(u, item) == 0;
+		}
+		if (ok)
+			item->pending = 0;
+		else
+			u->rearm[j++] = item;
+	}
+	u->rearm_n = j;
+	return n;
+}
+
+//处理一个完成事件，需要报告时填写e并返回1
+static int
+su_complete(struct uring_poll *u, struct io_uring_cqe *cqe, struct event *e) {
+	int op = (int)(cqe->user_data & URING_OP_MASK);
+	struct uring_item *item = (struct uring_item *)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+	int res = cqe->res;
+	int arm = (op == URING_OP_POLLOUT) ? URING_ARM_WRITE : URING_ARM_READ;
+	item->armed &= ~arm;
+	item->cancel &= ~arm;
+	if (op == URING_OP_RECV && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (item->dead || res <= 0) {
+			u->refill[u->refill_n++] = bid;
+		} else {
+			item->bid = bid;
+		}
+	}
+	if (item->dead) {
+		if (op == URING_OP_ACCEPT && res >= 0) {
+			close(res);
+		}
+		if (item->armed == 0 && !item->pending) {
+			su_free(u, item);
+		}
+		return 0;
+	}
+	if (op == URING_OP_POLLOUT && !item->write) {	//已经不需要监听可写事件了
+		return 0;
+	}
+	su_pending(u, item);
+	e->s = item->ud;
+	e->read = false;
+	e->write = false;
+	e->error = false;
+	switch (op) {
+	case URING_OP_POLLIN:
+	case URING_OP_POLLOUT:
+		if (res <= 0) {	//被取消的请求
+			return 0;
+		}
+		e->write = (res & POLLOUT) != 0;
+		e->read = (res & (POLLIN | POLLHUP)) != 0;
+		e->error = (res & POLLERR) != 0;
+		return 1;
+	case URING_OP_RECV:
+	case URING_OP_ACCEPT:
+		if (res == -ECANCELED || res == -ENOBUFS || res == -EAGAIN || res == -EINTR) {
+			return 0;	//下一次su_wait时重新提交
+		}
+		if (op == URING_OP_ACCEPT ? item->mode != SU_ACCEPT : item->mode != SU_RECV) {
+			if (op == URING_OP_ACCEPT && res >= 0)
+				close(res);
+			else if (op == URING_OP_RECV && res > 0)
+				u->refill[u->refill_n++] = item->bid;
+			return 0;
+		}
+		item->ready = 1;
+		item->result = res;
+		e->read = true;
+		return 1;
+	}
+	return 0;
+}
+
+//提交所有等待中的操作，等待至少一个完成事件，最多返回max个事件
+static int
+su_wait(struct uring_poll *u, struct event *e, int max) {
+	spinlock_lock(&u->lock);
+	u->owner = pthread_self();
+	int n = su_flush(u, e, max);
+	unsigned submit = su_unsubmitted(u);
+	spinlock_unlock(&u->lock);
+
+	unsigned head = *u->cq_head;
+	unsigned wait = (n > 0 || head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) ? 0 : 1;
+	if (submit > 0 || wait) {
+		if (su_enter(u->fd, submit, wait, IORING_ENTER_GETEVENTS) < 0) {
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				return -1;
+			}
+		}
+	}
+
+	spinlock_lock(&u->lock);
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail && n < max) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		++head;
+		if (cqe->user_data == 0) {		//取消请求和提供缓存的完成事件
+			continue;
+		}
+		n += su_complete(u, cqe, &e[n]);
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	spinlock_unlock(&u->lock);
+	if (n == 0) {
+		errno = EINTR;	// only cancellations completed, wait again
+		return -1;
+	}
+	return n;
+}
+
+static int
+su_read(struct uring_poll *u, int sock, void **buffer, int *n) {
+	spinlock_lock(&u->lock);
+	struct uring_item *item = sock < u->item_cap ? u->item[sock] : NULL;
+	if (item == NULL || !item->ready || item->mode != SU_RECV) {
+		spinlock_unlock(&u->lock);
+		return 0;
+	}
+	item->ready = 0;
+	int res = item->result;
+	if (res > 0) {
+		int bid = item->bid;
+		if (res > URING_BUFFER_SIZE / 2) {	//直接交出缓存，再分配一个新的提供给内核
+			*buffer = u->buffer[bid];
+			u->buffer[bid] = skynet_malloc(URING_BUFFER_SIZE);
+		} else {
+			*buffer = skynet_malloc(res);
+			memcpy(*buffer, u->buffer[bid], res);
+		}
+		u->refill[u->refill_n++] = bid;
+		*n = res;
+	} else {
+		*buffer = NULL;
+		*n = res < 0 ? -1 : 0;
+		if (res < 0)
+			errno = -res;
+	}
+	spinlock_unlock(&u->lock);
+	return 1;
+}
+
+static int
+su_accept(struct uring_poll *u, int sock, struct sockaddr *addr, socklen_t *len, int *fd) {
+	spinlock_lock(&u->lock);
+	struct uring_item *item = sock < u->item_cap ? u->item[sock] : NULL;
+	if (item == NULL || !item->ready || item->mode != SU_ACCEPT) {
+		spinlock_unlock(&u->lock);
+		return 0;
+	}
+	item->ready = 0;
+	int res = item->result;
+	if (res >= 0) {
+		socklen_t sz = item->addrlen < *len ? item->addrlen : *len;
+		memcpy(addr, &item->addr, sz);
+		*len = sz;
+		*fd = res;
+	} else {
+		*fd = -1;
+		errno = -res;
+	}
+	spinlock_unlock(&u->lock);
+	return 1;
+}
+
+#else
+
+static struct uring_poll *
+su_create(int entries) {
+	(void)entries;
+	return NULL;
+}
+
+static void su_release(struct uring_poll *u) {}
+static int su_add(struct uring_poll *u, int sock, void *ud) { return 1; }
+static void su_del(struct uring_poll *u, int sock) {}
+static void su_write(struct uring_poll *u, int sock, void *ud, bool enable) {}
+static void su_mode(struct uring_poll *u, int sock, int mode) {}
+static int su_wait(struct uring_poll *u, struct event *e, int max) { return -1; }
+static int su_read(struct uring_poll *u, int sock, void **buffer, int *n) { return 0; }
+static int su_accept(struct uring_poll *u, int sock, struct sockaddr *addr, socklen_t *len, int *fd) { return 0; }
+
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+local skynet = require "skynet"
+
+-- timeouts due in the same tick arrive as one message, each callback must still run once
+skynet.start(function()
+	skynet.coalescetimer(true)
+	local fired = {}
+	local n = 0
+	for i=1,1000 do
+		skynet.timeout(10 + i % 5, function()
+			assert(not fired[i])
+			fired[i] = true
+			n = n + 1
+		end)
+	end
+	local cancelled = skynet.timeout(12, function() error "cancelled timeout" end)
+	assert(skynet.canceltimeout(cancelled))
+
+	local woke = 0
+	for i=1,100 do
+		skynet.fork(function()
+			skynet.sleep(7)
+			woke = woke + 1
+		end)
+	end
+	skynet.sleep(50)
+	assert(n == 1000, n)
+	assert(woke == 100, woke)
+	assert(skynet.stat "message" < 100)	-- 1100 timers due in a few ticks
+	print("coalesce timer ok", skynet.stat "message")
+
+	skynet.coalescetimer(false)
+	local t = skynet.now()
+	skynet.sleep(10)
+	assert(skynet.now() >= t + 10)
+	print("coalesce timer off ok")
+	skynet.exit()
+end)
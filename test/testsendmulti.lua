@@ -0,0 +1,67 @@
+local skynet = require "skynet"
+require "skynet.manager"
+
+local mode = ...
+
+if mode == "forward" then
+
+-- forward mode keeps the message and frees it by skynet_free (c.trash), so it must get a private copy
+local count = 0
+local sum = 0
+
+skynet.forward_type( {} , function()
+	skynet.dispatch("lua", function (_,_, cmd, n)
+		if cmd == "data" then
+			count = count + 1
+			sum = sum + n
+		elseif cmd == "stat" then
+			skynet.ret(skynet.pack(count, sum))
+		end
+	end)
+end)
+
+elseif mode == "sub" then
+
+local count = 0
+local sum = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_,_, cmd, n)
+		if cmd == "data" then
+			count = count + 1
+			sum = sum + n
+		elseif cmd == "stat" then
+			skynet.ret(skynet.pack(count, sum))
+		end
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local addresses = {}
+	for i=1,5 do
+		table.insert(addresses, skynet.newservice(SERVICE_NAME, "forward"))
+		table.insert(addresses, skynet.newservice(SERVICE_NAME, "sub"))
+	end
+
+	local n = 0
+	for i=1,100 do
+		n = n + skynet.sendmulti(addresses, "lua", "data", i)
+		local shared = skynet.packshared("data", i)
+		n = n + skynet.rawsendmulti(addresses, "lua", shared)
+		skynet.rawsend(addresses[1], "lua", shared)
+	end
+	assert(n == 200 * #addresses)
+
+	for i, addr in ipairs(addresses) do
+		local count, sum = skynet.call(addr, "lua", "stat")
+		local expect = i == 1 and 300 or 200
+		print(skynet.address(addr), count, sum)
+		assert(count == expect and sum == expect * 5050 / 100)
+	end
+	print("sendmulti ok")
+	skynet.abort()
+end)
+
+end
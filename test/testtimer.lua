@@ -19,8 +19,29 @@ local function test()
 	end
 end
 
+local function test_cancel()
+	local fired = 0
+	local sessions = {}
+	for i=1,100 do
+		sessions[i] = skynet.timeout(10, function() fired = fired + 1 end)
+	end
+	for i=1,100 do
+		assert(skynet.canceltimeout(sessions[i]))
+		assert(not skynet.canceltimeout(sessions[i]))
+	end
+	local done = false
+	local session = skynet.timeout(10, function() done = true end)
+	skynet.sleep(30)
+	assert(fired == 0, fired)
+	-- a timeout that has fired can't be cancelled
+	assert(done)
+	assert(not skynet.canceltimeout(session))
+	print("test cancel timeout ok")
+end
+
 skynet.start(function()
 	test()
+	test_cancel()
 
 	skynet.fork(wakeup, coroutine.running())
 	skynet.timeout(300, function() timeout "Hello World" end)
@@ -19,7 +19,52 @@ local function client()
 	end
 end
 
+-- a socket in batch mode (socket.udp_batch) must see the same (data, address) as a plain one
+local function batch()
+	local recv = { plain = {}, batch = {} }
+	local function recorder(name)
+		local host
+		host = socket.udp(function(str, from)
+			if str == "ping" then
+				socket.sendto(host, from, name)
+			end
+			table.insert(recv[name], { str, from })
+		end, "127.0.0.1", name == "plain" and 8766 or 8767)
+		return host
+	end
+	recorder "plain"
+	socket.udp_batch(recorder "batch")
+
+	local server_addr = {}
+	local c = socket.udp(function(str, from)
+		server_addr[str] = from
+	end)
+	for port, name in pairs { [8766] = "plain", [8767] = "batch" } do
+		socket.udp_connect(c, "127.0.0.1", port)
+		socket.write(c, "ping")
+		while not server_addr[name] do
+			skynet.sleep(1)
+		end
+	end
+
+	local n = 200
+	for i=1,n do
+		local data = string.rep(string.char(i % 256), i)
+		socket.sendto(c, server_addr.plain, data)
+		socket.sendto(c, server_addr.batch, data)
+	end
+	while #recv.plain <= n or #recv.batch <= n do
+		skynet.sleep(1)
+	end
+	for i=1,n+1 do
+		local p, b = recv.plain[i], recv.batch[i]
+		assert(p[1] == b[1] and p[2] == b[2], i)
+	end
+	print("udp batch ok", socket.udp_address(recv.batch[1][2]))
+end
+
 skynet.start(function()
 	skynet.fork(server)
 	skynet.fork(client)
+	skynet.fork(batch)
 end)